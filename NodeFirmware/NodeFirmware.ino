@@ -27,6 +27,7 @@ const char *ssidtarget = "AMS-server";
 // Location of the server
 IPAddress destip(192,168,4,1);
 unsigned int serverUDPPort = 8888;
+unsigned int serverFECUDPPort = 8889;
 
 // Setup our listen port
 unsigned int localUDPPort = 8888;
@@ -272,11 +273,64 @@ void collectData() {
   accumulationSamplesSent++;
 }
 
+// ---------------------------
+// Forward Error Correction
+//
+// When FEC_GROUP_SIZE is defined a parity packet is sent after every
+// FEC_GROUP_SIZE data packets.  It holds the XOR of the data blocks of the
+// packets in the group and allows the server to rebuild any one lost packet
+// of the group.  Comment out FEC_GROUP_SIZE to turn this off.  For details
+// on the parity packet layout see ForwardErrorCorrection.h in the server.
+//
+// FEC_GROUP_SIZE MUST MATCH THE SERVER AND BE ONE OF 2, 4 OR 8
+#define FEC_GROUP_SIZE 4
+
+#ifdef FEC_GROUP_SIZE
+#define FEC_HEADER_SIZE_BYTES 4
+// The header plus the data blocks of a full packet.
+#define FEC_PACKET_SIZE (FEC_HEADER_SIZE_BYTES + (PACKETSAMPLESIZE / 4) * 5)
+char fecPacket[FEC_PACKET_SIZE];
+uint8_t fecPayloadLength = 0;
+
+// Adds the data blocks of the opacket into the parity packet and sends the
+// parity packet once the group is complete.
+void addPacketToParity() {
+  uint8_t number = opacket[1];
+  uint8_t groupPosition = number % FEC_GROUP_SIZE;
+  if (groupPosition == 0) {
+    memset(fecPacket, 0, FEC_PACKET_SIZE);
+    fecPayloadLength = 0;
+    fecPacket[0] = stationId;
+    fecPacket[1] = number;
+    fecPacket[2] = FEC_GROUP_SIZE;
+  }
+
+  uint8_t payloadLength = getPacketSize() - HEADER_SIZE_BYTES;
+  for (int i=0; i<payloadLength; i++) {
+    fecPacket[FEC_HEADER_SIZE_BYTES + i] ^= opacket[HEADER_SIZE_BYTES + i];
+  }
+  if (payloadLength > fecPayloadLength) {
+    fecPayloadLength = payloadLength;
+  }
+
+  if (groupPosition == FEC_GROUP_SIZE - 1) {
+    fecPacket[3] = fecPayloadLength;
+    Udp.beginPacket(destip, serverFECUDPPort);
+    Udp.write(fecPacket, FEC_HEADER_SIZE_BYTES + fecPayloadLength);
+    Udp.endPacket();
+  }
+}
+#endif
+
 // Sends whatever is in the opacket and resets counters
 void sendPacket() {
   Udp.beginPacket(destip, serverUDPPort);
   Udp.write(opacket, getPacketSize());
   Udp.endPacket();
+
+#ifdef FEC_GROUP_SIZE
+  addPacketToParity();
+#endif
 }
 
 void loop() {
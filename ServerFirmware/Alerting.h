@@ -0,0 +1,180 @@
+// Alerting.h
+//
+// Keeps running statistics for a station and checks them against a small set
+// of alert rules.  An alert rule fires when the (smoothed) sound level of a
+// station stays at or above a threshold for a sustained period and clears
+// once the level drops below a lower threshold.  The gap between the two
+// thresholds (hysteresis) keeps an alert from flickering on and off when the
+// level hovers around the threshold.
+//
+// Everything here is updated with each data point that is added to a station
+// so each update must be O(1) and use a fixed amount of memory.
+
+#ifndef ALERTING_H
+#define ALERTING_H
+
+// The number of alert rules that can be configured.  Every station tracks
+// the state of every rule.
+#define MAX_ALERT_RULES 2
+
+// The weight of each new data point in the exponential moving average.  With
+// a data point every 10ms this smooths over roughly 200ms.
+#define ALERT_EMA_ALPHA 0.05
+
+// A gap between two data points longer than this means the station went
+// silent.  No time is attributed to the gap and any run towards an alert
+// starts over, so a silent station doesn't accumulate time above a threshold
+// based on the last value it sent.
+#define ALERT_MAX_DATA_POINT_GAP_MS 1000
+
+struct AlertRule {
+  bool enabled;
+  // The moving average must reach threshold to start counting.
+  uint16_t threshold;
+  // Once fired the alert stays active until the moving average drops below
+  // clearThreshold.
+  uint16_t clearThreshold;
+  // How long the moving average must stay at or above threshold before the
+  // alert fires.
+  uint32_t sustainMillis;
+};
+
+struct AlertState {
+  bool active;
+  uint32_t currentRunMillis;
+  uint32_t totalTimeAboveMillis;
+  uint32_t triggerCount;
+};
+
+struct StationStatistics {
+  // Running mean and variance using Welford's algorithm.
+  uint32_t count;
+  float mean;
+  float m2;
+
+  float movingAverage;
+  uint32_t lastDataPointTime;
+
+  AlertState alerts[MAX_ALERT_RULES];
+};
+
+AlertRule alertRules[MAX_ALERT_RULES];
+
+void configureAlertRule(int index, uint16_t threshold, uint16_t clearThreshold,
+    uint32_t sustainMillis) {
+  alertRules[index].enabled = true;
+  alertRules[index].threshold = threshold;
+  alertRules[index].clearThreshold = clearThreshold;
+  alertRules[index].sustainMillis = sustainMillis;
+}
+
+void initializeStationStatistics(StationStatistics &s) {
+  s.count = 0;
+  s.mean = 0;
+  s.m2 = 0;
+  s.movingAverage = 0;
+  s.lastDataPointTime = 0;
+
+  for (int i=0; i<MAX_ALERT_RULES; i++) {
+    s.alerts[i].active = false;
+    s.alerts[i].currentRunMillis = 0;
+    s.alerts[i].totalTimeAboveMillis = 0;
+    s.alerts[i].triggerCount = 0;
+  }
+}
+
+float getStationVariance(const StationStatistics &s) {
+  if (s.count < 2) {
+    return 0;
+  }
+  return s.m2 / (s.count - 1);
+}
+
+bool isAnyAlertActive(const StationStatistics &s) {
+  for (int i=0; i<MAX_ALERT_RULES; i++) {
+    if (s.alerts[i].active) {
+      return true;
+    }
+  }
+  return false;
+}
+
+uint32_t getAlertTriggerCount(const StationStatistics &s) {
+  uint32_t result = 0;
+  for (int i=0; i<MAX_ALERT_RULES; i++) {
+    result += s.alerts[i].triggerCount;
+  }
+  return result;
+}
+
+/**
+ * Alert state only changes as data points arrive.  This clears the alerts of
+ * a station that has gone quiet for longer than ALERT_MAX_DATA_POINT_GAP_MS
+ * so they don't stay active forever.  A station that starts sending again
+ * must then sustain its level all over again before alerting.
+ */
+void ageStationStatistics(StationStatistics &s, uint32_t currentTime) {
+  if (s.count == 0 ||
+      (int32_t)(currentTime - s.lastDataPointTime) <= ALERT_MAX_DATA_POINT_GAP_MS) {
+    return;
+  }
+  for (int i=0; i<MAX_ALERT_RULES; i++) {
+    s.alerts[i].active = false;
+    s.alerts[i].currentRunMillis = 0;
+  }
+}
+
+void updateAlertState(AlertState &a, const AlertRule &rule, float level,
+    uint32_t elapsed) {
+  if (level >= rule.threshold) {
+    a.currentRunMillis += elapsed;
+    a.totalTimeAboveMillis += elapsed;
+    if (!a.active && a.currentRunMillis >= rule.sustainMillis) {
+      a.active = true;
+      a.triggerCount++;
+    }
+  } else {
+    a.currentRunMillis = 0;
+    if (a.active && level < rule.clearThreshold) {
+      a.active = false;
+    }
+  }
+}
+
+void updateStationStatistics(StationStatistics &s, uint16_t value, uint32_t time) {
+  s.count++;
+  float delta = value - s.mean;
+  s.mean += delta / s.count;
+  s.m2 += delta * (value - s.mean);
+
+  uint32_t elapsed = 0;
+  bool resumed = false;
+  if (s.count == 1) {
+    s.movingAverage = value;
+    s.lastDataPointTime = time;
+  } else {
+    s.movingAverage += ALERT_EMA_ALPHA * (value - s.movingAverage);
+    // Data points may arrive slightly out of order so a negative gap is
+    // treated as no time passing.
+    int32_t gap = (int32_t)(time - s.lastDataPointTime);
+    if (gap > ALERT_MAX_DATA_POINT_GAP_MS) {
+      resumed = true;
+    } else if (gap > 0) {
+      elapsed = gap;
+    }
+    if (gap > 0) {
+      s.lastDataPointTime = time;
+    }
+  }
+
+  for (int i=0; i<MAX_ALERT_RULES; i++) {
+    if (resumed) {
+      s.alerts[i].currentRunMillis = 0;
+    }
+    if (alertRules[i].enabled) {
+      updateAlertState(s.alerts[i], alertRules[i], s.movingAverage, elapsed);
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,184 @@
+// Export.h
+//
+// Writes the data held for a station (the recent data points and the longer
+// bucketed history) as either CSV or a compact binary form.  Output is built
+// up in a small fixed buffer and handed off to a flush function whenever the
+// buffer fills so the full export never has to be held in memory.  The flush
+// function is free to do other work (such as handling incoming packets) which
+// means the station may be updated while it is being exported.  Values that
+// are overwritten part way through show up as their newer values.
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+// This requires Station.h for the station data layout.
+#include "Station.h"
+
+#define EXPORT_CHUNK_SIZE 512
+
+// Section types for the binary format.
+#define EXPORT_SECTION_DATA_POINTS 1
+#define EXPORT_SECTION_HISTORY 2
+
+//
+// Binary format, all multi-byte values are little endian.  The export is a
+// sequence of sections.  A data points section is:
+//
+// 0           7 8         15 16        23 24        31
+// +------------+------------+------------+------------+
+// | Type (1)   | Station ID |         Count           |
+// +------------+------------+------------+------------+
+//
+// followed by 'Count' entries, oldest first, of:
+//
+// 0           7 8         15 16        23 24        31 32        39 40        47
+// +------------+------------+------------+------------+------------+------------+
+// |                       Time                        |         Value           |
+// +------------+------------+------------+------------+------------+------------+
+//
+// A history section is:
+//
+// 0           7 8         15 16        23 24        31
+// +------------+------------+------------+------------+
+// | Type (2)   | Station ID |         Count           |
+// +------------+------------+------------+------------+
+// |                Oldest Bucket Time                 |
+// +------------+------------+------------+------------+
+// |      Bucket Millis      |    Max Value 1 ...      |
+// +------------+------------+------------+------------+
+//
+// followed by the rest of the 'Count' 16 bit max values, oldest first.
+//
+// The CSV format has the header "type,station,time,value" and one line per
+// data point ("data") or history bucket ("history").  The time of a history
+// line is the start of its bucket.
+
+typedef void (*ExportFlushFunction)(const char *data, size_t length);
+
+struct ExportWriter {
+  char buffer[EXPORT_CHUNK_SIZE];
+  size_t length;
+  ExportFlushFunction flush;
+};
+
+void initializeExportWriter(ExportWriter &w, ExportFlushFunction flush) {
+  w.length = 0;
+  w.flush = flush;
+}
+
+void flushExportWriter(ExportWriter &w) {
+  if (w.length > 0) {
+    w.flush(w.buffer, w.length);
+    w.length = 0;
+  }
+}
+
+// Makes sure there are at least n bytes free in the buffer.
+void reserveExportWriter(ExportWriter &w, size_t n) {
+  if (w.length + n > EXPORT_CHUNK_SIZE) {
+    flushExportWriter(w);
+  }
+}
+
+void writeExportUint8(ExportWriter &w, uint8_t v) {
+  w.buffer[w.length++] = v;
+}
+
+void writeExportUint16(ExportWriter &w, uint16_t v) {
+  writeExportUint8(w, v & 0xFF);
+  writeExportUint8(w, (v >> 8) & 0xFF);
+}
+
+void writeExportUint32(ExportWriter &w, uint32_t v) {
+  writeExportUint16(w, v & 0xFFFF);
+  writeExportUint16(w, (v >> 16) & 0xFFFF);
+}
+
+void writeExportCSVLine(ExportWriter &w, const char *type, StationIdentifier id,
+    uint32_t time, uint16_t value) {
+  // The longest line is well under 48 characters.
+  reserveExportWriter(w, 48);
+  w.length += snprintf(w.buffer + w.length, EXPORT_CHUNK_SIZE - w.length,
+      "%s,%u,%lu,%u\n", type, id, (unsigned long) time, value);
+}
+
+void writeExportCSVHeader(ExportWriter &w) {
+  reserveExportWriter(w, 32);
+  w.length += snprintf(w.buffer + w.length, EXPORT_CHUNK_SIZE - w.length,
+      "type,station,time,value\n");
+}
+
+// The number of data points held and the index of the oldest one.
+uint8_t getExportDataPointRange(const Station &s, uint8_t &oldestIndex) {
+  uint8_t count = s.numberDataPoints;
+  if (count >= MAX_DATA_POINTS) {
+    count = MAX_DATA_POINTS;
+    oldestIndex = s.indexOfNextDataPoint % MAX_DATA_POINTS;
+  } else {
+    oldestIndex = 0;
+  }
+  return count;
+}
+
+uint16_t getExportOldestHistoryIndex(const Station &s, uint16_t count) {
+  return (s.historyNewestIndex + HISTORY_BUCKET_COUNT - count + 1) %
+    HISTORY_BUCKET_COUNT;
+}
+
+uint32_t getExportOldestHistoryTime(const Station &s, uint16_t count) {
+  return s.historyNewestBucketTime - (uint32_t)(count - 1) * TIME_DISCRETIZE_UNIT_MS;
+}
+
+void exportStationCSV(ExportWriter &w, const Station &s) {
+  // The ranges are captured once up front since the station may change
+  // whenever the writer flushes.
+  uint8_t oldestIndex;
+  uint8_t count = getExportDataPointRange(s, oldestIndex);
+  for (uint8_t i=0; i<count; i++) {
+    uint8_t index = (oldestIndex + i) % MAX_DATA_POINTS;
+    writeExportCSVLine(w, "data", s.id, s.audioDataPointTimes[index],
+        s.audioDataPointValues[index]);
+  }
+
+  uint16_t historyCount = s.historyBucketCount;
+  if (historyCount == 0) {
+    return;
+  }
+  uint16_t oldestHistoryIndex = getExportOldestHistoryIndex(s, historyCount);
+  uint32_t time = getExportOldestHistoryTime(s, historyCount);
+  for (uint16_t i=0; i<historyCount; i++) {
+    writeExportCSVLine(w, "history", s.id, time,
+        s.historyMaxValues[(oldestHistoryIndex + i) % HISTORY_BUCKET_COUNT]);
+    time += TIME_DISCRETIZE_UNIT_MS;
+  }
+}
+
+void exportStationBinary(ExportWriter &w, const Station &s) {
+  uint8_t oldestIndex;
+  uint8_t count = getExportDataPointRange(s, oldestIndex);
+  reserveExportWriter(w, 4);
+  writeExportUint8(w, EXPORT_SECTION_DATA_POINTS);
+  writeExportUint8(w, s.id);
+  writeExportUint16(w, count);
+  for (uint8_t i=0; i<count; i++) {
+    uint8_t index = (oldestIndex + i) % MAX_DATA_POINTS;
+    reserveExportWriter(w, 6);
+    writeExportUint32(w, s.audioDataPointTimes[index]);
+    writeExportUint16(w, s.audioDataPointValues[index]);
+  }
+
+  uint16_t historyCount = s.historyBucketCount;
+  uint16_t oldestHistoryIndex = getExportOldestHistoryIndex(s, historyCount);
+  reserveExportWriter(w, 10);
+  writeExportUint8(w, EXPORT_SECTION_HISTORY);
+  writeExportUint8(w, s.id);
+  writeExportUint16(w, historyCount);
+  writeExportUint32(w, historyCount ? getExportOldestHistoryTime(s, historyCount) : 0);
+  writeExportUint16(w, TIME_DISCRETIZE_UNIT_MS);
+  for (uint16_t i=0; i<historyCount; i++) {
+    reserveExportWriter(w, 2);
+    writeExportUint16(w, s.historyMaxValues[(oldestHistoryIndex + i) % HISTORY_BUCKET_COUNT]);
+  }
+}
+
+#endif
@@ -0,0 +1,202 @@
+// ForwardErrorCorrection.h
+//
+// Nodes can optionally send a parity packet after every FEC_GROUP_SIZE data
+// packets.  The parity packet holds the XOR of the data blocks of every packet
+// in the group so the server can rebuild any single packet of the group that
+// was lost without asking for a retransmit.
+//
+// Parity packets are sent to their own UDP port so that servers and nodes
+// which don't know about them are unaffected.
+
+#ifndef FORWARD_ERROR_CORRECTION_H
+#define FORWARD_ERROR_CORRECTION_H
+
+// This requires PacketDecoder.h for the layout of the data packets.
+#include "PacketDecoder.h"
+
+// The number of data packets covered by a single parity packet.  This must be
+// the same on the nodes and the server.  It must be a power of two no larger
+// than 8 so that groups line up with the 8 bit packet number wrapping around.
+#ifndef FEC_GROUP_SIZE
+#define FEC_GROUP_SIZE 4
+#endif
+
+// The number of groups tracked at once for each station.  Tracking more than
+// one allows the parity packet for a group to arrive after data packets from
+// the following group.
+#define FEC_TRACKED_GROUPS 2
+
+// The largest data block area that a data packet can carry.
+#define FEC_MAX_PAYLOAD_SIZE ((MAX_DATA_POINTS / 4) * 5)
+
+// Locations and total header size, in bytes, for the parity packet.
+#define FEC_SENDER_LOC 0
+#define FEC_FIRST_PACKET_NUMBER_LOC 1
+#define FEC_GROUP_SIZE_LOC 2
+#define FEC_PAYLOAD_LENGTH_LOC 3
+#define FEC_HEADER_SIZE (FEC_PAYLOAD_LENGTH_LOC+1)
+
+//
+// Parity packet structure
+//
+// 0           7 8         15 16        23 24        31
+// +------------+------------+------------+------------+
+// | Sender     | First Num  | Group Size | Length     |
+// +------------+------------+------------+------------+
+// |    XOR of the data blocks of each packet in       |
+// +------------+------------+------------+------------+
+// |    the group.  'Length' bytes long.               |
+// +------------+------------+------------+------------+
+//            ...
+//
+// 'First Num' is the packet number of the first packet in the group and is
+// always a multiple of the group size.  Data packets shorter than 'Length'
+// are treated as if they were padded with zeros.
+
+struct FECGroup {
+  bool active;
+  PacketNumber firstPacketNumber;
+  uint8_t receivedMask;
+  // The packets of the group that were rebuilt from the parity packet.
+  uint8_t recoveredMask;
+  byte parity[FEC_MAX_PAYLOAD_SIZE];
+};
+
+struct FECState {
+  FECGroup groups[FEC_TRACKED_GROUPS];
+  uint32_t recoveredPacketCount;
+  uint32_t unrecoverableGroupCount;
+};
+
+void initializeFECState(FECState &f) {
+  for (int i=0; i<FEC_TRACKED_GROUPS; i++) {
+    f.groups[i].active = false;
+    f.groups[i].firstPacketNumber = 0;
+    f.groups[i].receivedMask = 0;
+    f.groups[i].recoveredMask = 0;
+  }
+  f.recoveredPacketCount = 0;
+  f.unrecoverableGroupCount = 0;
+}
+
+PacketNumber getFECGroupStart(const PacketNumber p) {
+  return p - (p % FEC_GROUP_SIZE);
+}
+
+FECGroup &getFECGroup(FECState &f, const PacketNumber groupStart) {
+  return f.groups[(groupStart / FEC_GROUP_SIZE) % FEC_TRACKED_GROUPS];
+}
+
+/**
+ * Returns true when the packet number was rebuilt from a parity packet.  A
+ * data packet that shows up after it was rebuilt must not be used again.
+ * Ordinary duplicates are left for isPacketValid to catch.
+ */
+bool isFECPacketRecovered(FECState &f, const PacketNumber p) {
+  PacketNumber groupStart = getFECGroupStart(p);
+  FECGroup &group = getFECGroup(f, groupStart);
+  if (!group.active || group.firstPacketNumber != groupStart) {
+    return false;
+  }
+  return (group.recoveredMask & (1 << (p - groupStart))) != 0;
+}
+
+/**
+ * Folds a valid data packet into the parity tracked for its group.  This must
+ * only be called once per packet number (after isPacketValid) otherwise the
+ * XOR will cancel itself out.
+ */
+void recordFECDataPacket(FECState &f, const byte * const packet, int packetLength) {
+  PacketNumber p = getPacketNumber(packet);
+  PacketNumber groupStart = getFECGroupStart(p);
+  FECGroup &group = getFECGroup(f, groupStart);
+
+  if (!group.active || group.firstPacketNumber != groupStart) {
+    // A new group is replacing whatever was tracked in this slot.
+    group.active = true;
+    group.firstPacketNumber = groupStart;
+    group.receivedMask = 0;
+    group.recoveredMask = 0;
+    memset(group.parity, 0, FEC_MAX_PAYLOAD_SIZE);
+  }
+
+  uint8_t bit = 1 << (p - groupStart);
+  if (group.receivedMask & bit) {
+    return;
+  }
+  group.receivedMask |= bit;
+
+  int payloadLength = packetLength - HEADER_SIZE;
+  if (payloadLength > FEC_MAX_PAYLOAD_SIZE) {
+    payloadLength = FEC_MAX_PAYLOAD_SIZE;
+  }
+  for (int i=0; i<payloadLength; i++) {
+    group.parity[i] ^= packet[HEADER_SIZE + i];
+  }
+}
+
+/**
+ * Given a parity packet this will rebuild the single missing data packet of
+ * its group into recoveredPacket (which must be able to hold HEADER_SIZE +
+ * FEC_MAX_PAYLOAD_SIZE bytes) and return its length.  Returns 0 when there is
+ * nothing to recover, either because the whole group arrived or because more
+ * than one packet of the group was lost.
+ */
+int recoverFECPacket(FECState &f, const byte * const parityPacket,
+    int parityLength, byte * const recoveredPacket) {
+  if (parityLength < FEC_HEADER_SIZE ||
+      parityPacket[FEC_GROUP_SIZE_LOC] != FEC_GROUP_SIZE) {
+    return 0;
+  }
+
+  PacketNumber groupStart = parityPacket[FEC_FIRST_PACKET_NUMBER_LOC];
+  int payloadLength = parityPacket[FEC_PAYLOAD_LENGTH_LOC];
+  if (payloadLength > FEC_MAX_PAYLOAD_SIZE) {
+    return 0;
+  }
+
+  FECGroup &group = getFECGroup(f, groupStart);
+  if (!group.active || group.firstPacketNumber != groupStart) {
+    // None of the data packets for this group arrived.
+    f.unrecoverableGroupCount++;
+    return 0;
+  }
+
+  const uint8_t fullMask = (1 << FEC_GROUP_SIZE) - 1;
+  uint8_t missing = fullMask & ~group.receivedMask;
+  if (missing == 0) {
+    return 0;
+  }
+  if ((missing & (missing - 1)) != 0) {
+    // More than one packet is missing which XOR parity can not rebuild.
+    f.unrecoverableGroupCount++;
+    return 0;
+  }
+
+  uint8_t missingIndex = 0;
+  while ((missing & (1 << missingIndex)) == 0) {
+    missingIndex++;
+  }
+
+  recoveredPacket[PACKET_SENDER_LOC] = parityPacket[FEC_SENDER_LOC];
+  recoveredPacket[PACKET_NUMBER_LOC] = groupStart + missingIndex;
+
+  // The parity packet itself may have had trailing zero bytes truncated (see
+  // getSampleLength) so anything past what was received is treated as zero.
+  for (int i=0; i<payloadLength; i++) {
+    byte parityByte = 0;
+    if (FEC_HEADER_SIZE + i < parityLength) {
+      parityByte = parityPacket[FEC_HEADER_SIZE + i];
+    }
+    recoveredPacket[HEADER_SIZE + i] = group.parity[i] ^ parityByte;
+  }
+
+  // Mark the group as complete so a duplicate parity packet is ignored and
+  // so isFECPacketRecovered rejects the original if it turns up late.
+  group.receivedMask = fullMask;
+  group.recoveredMask = missing;
+  f.recoveredPacketCount++;
+  return HEADER_SIZE + payloadLength;
+}
+
+#endif
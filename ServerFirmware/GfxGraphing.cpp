@@ -26,11 +26,13 @@ SegmentedBarGraph::SegmentedBarGraph(Adafruit_GFX &d, int topLeftX, int topLeftY
   segmentHeight = height / numberSegments;
 
   /* Initialize state values used by the graph. */
-  for (int i=0; i<MOST_RECENT_VALUES_COUNT_MAX; i++) {
+  for (int i=0; i<HIGH_WATER_DEQUE_CAPACITY; i++) {
     mostRecentValues[i] = 0;
+    mostRecentValueMillis[i] = 0;
   }
-  mostRecentValuesIndex = -1;
-  mostRecentValueMillis = 0;
+  mostRecentValuesFront = 0;
+  mostRecentValuesCount = 0;
+  setHighWaterMarkDurationMillis(DEFAULT_HIGH_WATER_DURATION_MS);
 
   currentValue = 0;
   currentSampleSum = 0;
@@ -38,6 +40,8 @@ SegmentedBarGraph::SegmentedBarGraph(Adafruit_GFX &d, int topLeftX, int topLeftY
   currentSampleCount = 0;
   priorValue = 0;
   priorMax = 0;
+  alertActive = false;
+  priorAlertActive = false;
 
   setupMode = true;
   maintainPriorViewMillis = 3000;
@@ -59,6 +63,10 @@ void SegmentedBarGraph::setSegmentGroupColors(uint16_t colorGroupOne,
   this->segmentGroupThreeColor = colorGroupThree;
 }
 
+void SegmentedBarGraph::setAlertActive(bool alertActive) {
+  this->alertActive = alertActive;
+}
+
 void SegmentedBarGraph::setMinAndMaxYAxisValues(float minYAxisValue,
     float maxYAxisValue) {
   this->minYAxisValue = minYAxisValue;
@@ -70,6 +78,23 @@ void SegmentedBarGraph::setMaintainPriorViewMills(
   this->maintainPriorViewMillis = maintainPriorViewMillis;
 }
 
+void SegmentedBarGraph::setHighWaterMarkDurationMillis(
+    uint32_t highWaterDurationMillis) {
+  this->highWaterDurationMillis = highWaterDurationMillis;
+
+  // A bucket is kept until its end leaves the window (see
+  // expireMostRecentValues) so at most floor(D / bucket) + 2 distinct buckets
+  // are live at once.  Rounding the bucket size up keeps that within
+  // HIGH_WATER_DEQUE_CAPACITY so the deque can not overflow.
+  highWaterBucketMillis = (highWaterDurationMillis + HIGH_WATER_DEQUE_CAPACITY - 3) /
+    (HIGH_WATER_DEQUE_CAPACITY - 2);
+  if (highWaterBucketMillis == 0) {
+    highWaterBucketMillis = 1;
+  }
+  mostRecentValuesFront = 0;
+  mostRecentValuesCount = 0;
+}
+
 
 void SegmentedBarGraph::startGraphing() {
   if (setupMode == false) {
@@ -89,59 +114,92 @@ void SegmentedBarGraph::drawFrame() {
   }
 }
 
-void SegmentedBarGraph::handleMostRecentValues(float value) {
-  uint32_t currentMillis = millis();
-
-  if (currentMillis - mostRecentValueMillis > 1000) {
-    // A new second has passed.
-    mostRecentValueMillis = currentMillis;
-    mostRecentValuesIndex++;
+/**
+  * Removes values from the front of the deque that have fallen outside of
+  * the high water mark window.  Entries are stamped with the start of their
+  * bucket so an entry is only removed once the whole bucket is outside the
+  * window.  The mark may then be held up to one bucket too long but is never
+  * dropped early.
+  */
+void SegmentedBarGraph::expireMostRecentValues(uint32_t currentMillis) {
+  while (mostRecentValuesCount > 0 &&
+      currentMillis - mostRecentValueMillis[mostRecentValuesFront] >
+      highWaterDurationMillis + highWaterBucketMillis) {
+    mostRecentValuesFront = (mostRecentValuesFront + 1) % HIGH_WATER_DEQUE_CAPACITY;
+    mostRecentValuesCount--;
+  }
+}
 
-    if (mostRecentValuesIndex == MOST_RECENT_VALUES_COUNT_MAX) {
-      // Shuffle everything to the left
-      for (int i=1; i<MOST_RECENT_VALUES_COUNT_MAX; i++) {
-        mostRecentValues[i-1] = mostRecentValues[i];
+/**
+  * Pushes a value onto the back of the monotonic deque.  Any values at the
+  * back that are not larger than the new value can never be the maximum
+  * again (they expire no later than the new value) so they are dropped.
+  * This keeps the values in the deque strictly decreasing from front to
+  * back and the maximum is always at the front.
+  */
+void SegmentedBarGraph::handleMostRecentValues(float value, uint32_t currentMillis) {
+  expireMostRecentValues(currentMillis);
+
+  uint32_t bucketMillis = currentMillis - (currentMillis % highWaterBucketMillis);
+
+  while (mostRecentValuesCount > 0) {
+    uint8_t back = (mostRecentValuesFront + mostRecentValuesCount - 1) %
+      HIGH_WATER_DEQUE_CAPACITY;
+    if (mostRecentValues[back] > value) {
+      // The back of the deque is larger.  If it is in the same (or a later)
+      // time bucket then it outlives this value and there is nothing to do.
+      if ((int32_t)(bucketMillis - mostRecentValueMillis[back]) <= 0) {
+        return;
       }
-      mostRecentValuesIndex = MOST_RECENT_VALUES_COUNT_MAX - 1;
+      break;
     }
-    mostRecentValues[mostRecentValuesIndex] = value;
-  } else {
-    // Otherwise we look at the mostRecentValuesIndex index in the
-    // mostRecentValues array and see if this new value is larger.
-    if (value > mostRecentValues[mostRecentValuesIndex]) {
+    mostRecentValuesCount--;
+  }
+
 #ifdef DEBUG_PRINT
-      Serial.printf(
-          "handleMostRecentValues - duplicate second but larger value; "
-          "old Max: %f, newMax: %f\n",
-          mostRecentValues[mostRecentValuesIndex], value);
+  if (mostRecentValuesCount == 0) {
+    Serial.printf("handleMostRecentValues - new high water mark; newMax: %f\n",
+        value);
+  }
 #endif
-      mostRecentValues[mostRecentValuesIndex] = value;
-    }
+
+  if (mostRecentValuesCount == HIGH_WATER_DEQUE_CAPACITY) {
+    // The bucket sizing should prevent this but rather than overwrite the
+    // front of the ring the oldest value is expired early.
+    mostRecentValuesFront = (mostRecentValuesFront + 1) % HIGH_WATER_DEQUE_CAPACITY;
+    mostRecentValuesCount--;
   }
+
+  uint8_t index = (mostRecentValuesFront + mostRecentValuesCount) %
+    HIGH_WATER_DEQUE_CAPACITY;
+  mostRecentValues[index] = value;
+  mostRecentValueMillis[index] = bucketMillis;
+  mostRecentValuesCount++;
 }
 
-float SegmentedBarGraph::getMostRecentMaxValue() {
-  float max = 0;
-  for (int i=0; i<MOST_RECENT_VALUES_COUNT_MAX; i++) {
-    if (mostRecentValues[i] > max) {
-      max = mostRecentValues[i];
-    }
+float SegmentedBarGraph::getMostRecentMaxValue(uint32_t currentMillis) {
+  expireMostRecentValues(currentMillis);
+  if (mostRecentValuesCount == 0) {
+    return 0;
   }
-  return max;
+  return mostRecentValues[mostRecentValuesFront];
 }
 
+void SegmentedBarGraph::checkValueRange(float minValue, float maxValue) {
+  if (maxValue>maxYAxisValue) {
+    throw std::invalid_argument("y value provided is too large");
+  }
+  if (minValue<minYAxisValue) {
+    throw std::invalid_argument("y value provided is too small");
+  }
+}
 
 void SegmentedBarGraph::addDatasetValue(float y) {
   if (setupMode) {
     throw std::logic_error("Must be fully setup before usage.");
   }
-  if (y>maxYAxisValue) {
-    throw std::invalid_argument("y value provided is too large");
-  }
-  if (y<minYAxisValue) {
-    throw std::invalid_argument("y value provided is too small");
-  }
-  handleMostRecentValues(y);
+  checkValueRange(y, y);
+  handleMostRecentValues(y, millis());
 
   currentSampleSum += y;
   if (y > currentSampleMax) {
@@ -150,9 +208,53 @@ void SegmentedBarGraph::addDatasetValue(float y) {
   currentSampleCount++;
 }
 
+void SegmentedBarGraph::addDatasetValues(const uint16_t* samples, uint16_t n,
+    uint32_t timestamp) {
+  if (setupMode) {
+    throw std::logic_error("Must be fully setup before usage.");
+  }
+  if (n == 0) {
+    return;
+  }
+
+  // Gather everything needed from the batch in a single pass and only then
+  // validate and fold it into the graph state.
+  uint32_t sum = 0;
+  uint16_t batchMin = samples[0];
+  uint16_t batchMax = samples[0];
+  for (uint16_t i=0; i<n; i++) {
+    uint16_t v = samples[i];
+    sum += v;
+    if (v > batchMax) {
+      batchMax = v;
+    }
+    if (v < batchMin) {
+      batchMin = v;
+    }
+  }
+  checkValueRange(batchMin, batchMax);
+
+  // Every sample in the batch shares a timestamp so only the largest one
+  // matters for the high water mark.
+  handleMostRecentValues(batchMax, timestamp);
+
+  currentSampleSum += sum;
+  if (batchMax > currentSampleMax) {
+    currentSampleMax = batchMax;
+  }
+  currentSampleCount += n;
+}
+
 void SegmentedBarGraph::render() {
   uint32_t currentTime = millis();
 
+  // The alert marker is independent of the data so it is handled even when
+  // the view below is maintained.
+  if (alertActive != priorAlertActive) {
+    drawAlertMarker(alertActive);
+    priorAlertActive = alertActive;
+  }
+
   // currentSampleCount has the number of datasamples that have been received
   // since the last render.  If this is 0 and we last update the view within
   // the configured 'maintainPriorViewMillis' then we just don't do anything
@@ -181,7 +283,7 @@ void SegmentedBarGraph::render() {
     drawBars(currentValue, priorValue);
   }
 
-  float max = getMostRecentMaxValue();
+  float max = getMostRecentMaxValue(currentTime);
   if (priorMax != max) {
     drawMax(max, priorMax);
   }
@@ -312,3 +414,11 @@ void SegmentedBarGraph::drawMax(float current, float prior) {
         width+6, segmentGroupThreeColor);
   }
 }
+
+/**
+  * The alert marker is a bar that sits just above the graph.
+  */
+void SegmentedBarGraph::drawAlertMarker(bool alertActive) {
+  uint16_t color = alertActive ? segmentGroupThreeColor : backgroundColor;
+  display.fillRect(topLeftX, topLeftY - 8, width, 5, color);
+}
@@ -2,10 +2,14 @@
 #ifndef GFX_GRAPHING
 #define GFX_GRAPHING
 
-// The number of recent data points to track in order to show the
-// maximum value for the past.  The value here is tracked as 'seconds'
-// with one maximum datapoint value for each second.
-#define MOST_RECENT_VALUES_COUNT_MAX 4
+// The high water mark shows the maximum value seen over a sliding window of
+// time (see setHighWaterMarkDurationMillis).  It is tracked with a monotonic
+// deque of (value, time) entries whose values are strictly decreasing from
+// front to back.  Entries are coalesced into time buckets of roughly
+// duration / (HIGH_WATER_DEQUE_CAPACITY - 2) milliseconds so that the memory
+// used is fixed regardless of how many samples arrive within the window.
+#define HIGH_WATER_DEQUE_CAPACITY 32
+#define DEFAULT_HIGH_WATER_DURATION_MS 4000
 
 /**
   * SegmentedBarGraph is a class that handles the display of a dataset by
@@ -37,6 +41,12 @@
   *    }
   *    g->render();
   *
+  * When many samples arrive at once (such as all of the samples in a single
+  * packet) addDatasetValues folds all of them in with one pass:
+  *
+  *    g->addDatasetValues(p.samples, p.sampleCount, millis());
+  *    g->render();
+  *
   */
 class SegmentedBarGraph {
 public:
@@ -55,6 +65,10 @@ public:
      even though no data values have been processed. */
   void setMaintainPriorViewMills(uint32_t maintainPriorViewMillis);
 
+  /* The amount of time that a value is considered for the high water mark.
+     Changing this clears any high water mark that has been accumulated. */
+  void setHighWaterMarkDurationMillis(uint32_t highWaterDurationMillis);
+
   /* The group colors used by bar graph.  The bottom most 'leds' will be
    * shown as colorGroupOne.  These are considered "Ok" values and usually
    * should be set 'green' or some other affirmative color.  The next set
@@ -65,6 +79,10 @@ public:
   void setSegmentGroupColors(uint16_t colorGroupOne, uint16_t colorGroupTwo,
       uint16_t colorGroupThree);
 
+  /* Shows (or hides) a marker above the graph, drawn in colorGroupThree, on
+     the next render.  Used to flag that an alert is active. */
+  void setAlertActive(bool alertActive);
+
   /**
     * call startGraphing when you are done with the configuration and
     * want the initial drawing of the frame to occur.  This must be
@@ -79,6 +97,15 @@ public:
     */
   void addDatasetValue(float y);
 
+  /**
+    * addDatasetValues is the batch form of addDatasetValue.  All n samples
+    * are considered to have arrived at the same timestamp (in millis) so the
+    * setup and range checks along with the high water mark update are done
+    * once for the whole batch.  If any sample is out of range then an
+    * exception is thrown and none of the samples are used.
+    */
+  void addDatasetValues(const uint16_t* samples, uint16_t n, uint32_t timestamp);
+
   /**
     * render will draw the average of all values passed in between this
     * call and the prior render.  If no data values are provided in the last
@@ -92,9 +119,12 @@ protected:
   void setupDefaults();
   void drawBars(float current, float prior);
   void drawMax(float current, float prior);
+  void drawAlertMarker(bool alertActive);
   uint8_t mapValueToSegmentCount(float v);
-  float getMostRecentMaxValue();
-  void handleMostRecentValues(float value);
+  float getMostRecentMaxValue(uint32_t currentMillis);
+  void handleMostRecentValues(float value, uint32_t currentMillis);
+  void expireMostRecentValues(uint32_t currentMillis);
+  void checkValueRange(float minValue, float maxValue);
   uint16_t getSegmentColor(uint8_t segment);
   uint16_t getSegmentTopLeftY(uint8_t segment);
 
@@ -116,9 +146,14 @@ private:
 
   float minYAxisValue, maxYAxisValue;
 
-  float mostRecentValues[MOST_RECENT_VALUES_COUNT_MAX];
-  int mostRecentValuesIndex;
-  uint32_t mostRecentValueMillis;
+  // Monotonic deque for the high water mark, stored as a ring buffer.  The
+  // front is the largest value within the window.
+  float mostRecentValues[HIGH_WATER_DEQUE_CAPACITY];
+  uint32_t mostRecentValueMillis[HIGH_WATER_DEQUE_CAPACITY];
+  uint8_t mostRecentValuesFront;
+  uint8_t mostRecentValuesCount;
+  uint32_t highWaterDurationMillis;
+  uint32_t highWaterBucketMillis;
 
   uint32_t timeViewDisplayedMillis;
   uint32_t maintainPriorViewMillis;
@@ -133,6 +168,9 @@ private:
   float currentValue;
   float priorValue;
   float priorMax;
+
+  bool alertActive;
+  bool priorAlertActive;
 };
 
 #endif
@@ -0,0 +1,226 @@
+// JitterBuffer.h
+//
+// A node takes a sample every SAMPLE_DURATION_MS and sends them in packets.
+// All of the samples in a packet arrive at once and, thanks to Wi-Fi, the
+// packets themselves arrive at uneven times.  Feeding samples to the display
+// as they arrive makes it jump in bursts.
+//
+// The jitter buffer instead works out when each sample was (approximately)
+// captured on the node and holds on to it until a fixed playout delay after
+// that.  Samples are then released one at a time at the cadence they were
+// captured at.
+//
+// Capture times are inferred from the packet numbers.  The buffer keeps an
+// estimate of when the last sample of the newest packet was captured and of
+// the time between packets.  For each packet the expected arrival time is
+// predicted from these and the difference to the actual arrival time (the
+// deviation) is used to slowly correct both estimates (a simple phase locked
+// loop).  The smoothed size of the deviation is the jitter and the playout
+// delay adapts to be a multiple of it.
+
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+// This requires PacketDecoder.h for PacketData.
+#include "PacketDecoder.h"
+
+// Matches SAMPLE_DURATION_MS in the NodeFirmware.  Only used as a starting
+// point, the actual time between samples is estimated as packets arrive.
+#define NODE_SAMPLE_DURATION_MS 10
+
+// The maximum number of samples held for a station.
+#define JITTER_BUFFER_CAPACITY 128
+
+// The playout delay is JITTER_PLAYOUT_MULTIPLE times the jitter, kept within
+// the given range.
+#define JITTER_PLAYOUT_MULTIPLE 3
+#define JITTER_MIN_PLAYOUT_DELAY_MS 20
+#define JITTER_MAX_PLAYOUT_DELAY_MS 400
+
+// How quickly the capture time and packet period estimates follow the
+// deviation.  Each packet corrects them by deviation / gain.
+#define JITTER_CAPTURE_TIME_GAIN 16
+#define JITTER_PERIOD_GAIN 64
+
+// Deviations larger than this (a node was paused, for example) start the
+// estimates over again.
+#define JITTER_RESYNC_MS 1000
+
+struct JitterBuffer {
+  uint16_t values[JITTER_BUFFER_CAPACITY];
+  uint32_t captureTimes[JITTER_BUFFER_CAPACITY];
+  PacketNumber packetNumbers[JITTER_BUFFER_CAPACITY];
+  uint8_t head;
+  uint8_t count;
+
+  bool synchronized;
+  PacketNumber lastPacketNumber;
+  // Inferred capture time of the last sample in the newest packet.
+  uint32_t lastCaptureTime;
+  float packetPeriodMillis;
+  float jitterMillis;
+  uint32_t playoutDelayMillis;
+
+  // Statistics.
+  uint32_t packetCount;
+  uint32_t maxDeviationMillis;
+  uint32_t lateSampleCount;
+  uint32_t overflowSampleCount;
+  uint32_t resyncCount;
+};
+
+void initializeJitterBuffer(JitterBuffer &j) {
+  j.head = 0;
+  j.count = 0;
+  j.synchronized = false;
+  j.lastPacketNumber = 0;
+  j.lastCaptureTime = 0;
+  j.packetPeriodMillis = 0;
+  j.jitterMillis = 0;
+  j.playoutDelayMillis = JITTER_MIN_PLAYOUT_DELAY_MS;
+
+  j.packetCount = 0;
+  j.maxDeviationMillis = 0;
+  j.lateSampleCount = 0;
+  j.overflowSampleCount = 0;
+  j.resyncCount = 0;
+}
+
+// How long after it was captured a sample is released.  A sample can't
+// arrive before the rest of its packet is captured so a packet period is
+// always part of the delay.
+uint32_t getJitterDelay(const JitterBuffer &j) {
+  return (uint32_t)j.packetPeriodMillis + j.playoutDelayMillis;
+}
+
+// The time at which a sample captured at captureTime is released.
+uint32_t getJitterReleaseTime(const JitterBuffer &j, uint32_t captureTime) {
+  return captureTime + getJitterDelay(j);
+}
+
+void pushJitterSample(JitterBuffer &j, uint16_t value, uint32_t captureTime,
+    PacketNumber p) {
+  if (j.count == JITTER_BUFFER_CAPACITY) {
+    // Drop the oldest sample to make room.
+    j.head = (j.head + 1) % JITTER_BUFFER_CAPACITY;
+    j.count--;
+    j.overflowSampleCount++;
+  }
+
+  // Samples are kept in capture time order.  They almost always arrive in
+  // that order but a recovered or reordered packet is moved back into place.
+  int index = (j.head + j.count) % JITTER_BUFFER_CAPACITY;
+  for (int i=j.count; i>0; i--) {
+    int prior = (index + JITTER_BUFFER_CAPACITY - 1) % JITTER_BUFFER_CAPACITY;
+    if ((int32_t)(j.captureTimes[prior] - captureTime) <= 0) {
+      break;
+    }
+    j.values[index] = j.values[prior];
+    j.captureTimes[index] = j.captureTimes[prior];
+    j.packetNumbers[index] = j.packetNumbers[prior];
+    index = prior;
+  }
+  j.values[index] = value;
+  j.captureTimes[index] = captureTime;
+  j.packetNumbers[index] = p;
+  j.count++;
+}
+
+/**
+ * Adds the samples of a packet that arrived at arrivalTime, working out the
+ * capture time for each one.
+ */
+void addJitterBufferPacket(JitterBuffer &j, const PacketData &p, uint32_t arrivalTime) {
+  if (p.sampleCount == 0) {
+    return;
+  }
+  j.packetCount++;
+
+  uint32_t captureTime;
+  if (!j.synchronized) {
+    j.synchronized = true;
+    j.packetPeriodMillis = p.sampleCount * NODE_SAMPLE_DURATION_MS;
+    j.lastPacketNumber = p.packetNumber;
+    j.lastCaptureTime = arrivalTime;
+    captureTime = arrivalTime;
+  } else {
+    int8_t packetDelta = (int8_t)(p.packetNumber - j.lastPacketNumber);
+    uint32_t predicted = j.lastCaptureTime + (int32_t)(packetDelta * j.packetPeriodMillis);
+    int32_t deviation = (int32_t)(arrivalTime - predicted);
+    uint32_t absDeviation = deviation < 0 ? -deviation : deviation;
+
+    if (absDeviation > JITTER_RESYNC_MS) {
+      j.resyncCount++;
+      j.lastPacketNumber = p.packetNumber;
+      j.lastCaptureTime = arrivalTime;
+      captureTime = arrivalTime;
+    } else if (packetDelta > 0) {
+      j.jitterMillis += (absDeviation - j.jitterMillis) / JITTER_CAPTURE_TIME_GAIN;
+      if (absDeviation > j.maxDeviationMillis) {
+        j.maxDeviationMillis = absDeviation;
+      }
+
+      // The estimate isn't clamped so that early and late packets correct it
+      // equally but nothing in this packet can be captured after it arrived.
+      j.lastCaptureTime = predicted + deviation / JITTER_CAPTURE_TIME_GAIN;
+      captureTime = j.lastCaptureTime;
+      if ((int32_t)(captureTime - arrivalTime) > 0) {
+        captureTime = arrivalTime;
+      }
+
+      float nominalPeriod = p.sampleCount * NODE_SAMPLE_DURATION_MS;
+      j.packetPeriodMillis += (float)deviation / packetDelta / JITTER_PERIOD_GAIN;
+      if (j.packetPeriodMillis < nominalPeriod / 2) {
+        j.packetPeriodMillis = nominalPeriod / 2;
+      } else if (j.packetPeriodMillis > nominalPeriod * 2) {
+        j.packetPeriodMillis = nominalPeriod * 2;
+      }
+
+      j.lastPacketNumber = p.packetNumber;
+    } else {
+      // An older (or duplicate) packet only gets placed relative to the
+      // newest one and doesn't change the estimates.
+      captureTime = predicted;
+    }
+  }
+
+  uint32_t playoutDelay = JITTER_PLAYOUT_MULTIPLE * j.jitterMillis;
+  if (playoutDelay < JITTER_MIN_PLAYOUT_DELAY_MS) {
+    playoutDelay = JITTER_MIN_PLAYOUT_DELAY_MS;
+  } else if (playoutDelay > JITTER_MAX_PLAYOUT_DELAY_MS) {
+    playoutDelay = JITTER_MAX_PLAYOUT_DELAY_MS;
+  }
+  j.playoutDelayMillis = playoutDelay;
+
+  // captureTime is for the last sample of the packet and the ones before it
+  // are spaced evenly over the packet period.
+  float sampleSpacing = j.packetPeriodMillis / p.sampleCount;
+  for (int i=0; i<p.sampleCount; i++) {
+    uint32_t sampleTime = captureTime -
+      (uint32_t)((p.sampleCount - 1 - i) * sampleSpacing);
+    if ((int32_t)(getJitterReleaseTime(j, sampleTime) - arrivalTime) < 0) {
+      j.lateSampleCount++;
+    }
+    pushJitterSample(j, p.samples[i], sampleTime, p.packetNumber);
+  }
+}
+
+/**
+ * Removes the oldest sample if it is due to be released by currentTime.
+ * Returns false when there is nothing to release.
+ */
+bool releaseJitterBufferSample(JitterBuffer &j, uint32_t currentTime,
+    uint16_t &value, uint32_t &captureTime, PacketNumber &p) {
+  if (j.count == 0 ||
+      (int32_t)(currentTime - getJitterReleaseTime(j, j.captureTimes[j.head])) < 0) {
+    return false;
+  }
+  value = j.values[j.head];
+  captureTime = j.captureTimes[j.head];
+  p = j.packetNumbers[j.head];
+  j.head = (j.head + 1) % JITTER_BUFFER_CAPACITY;
+  j.count--;
+  return true;
+}
+
+#endif
@@ -26,6 +26,10 @@
 #include <WiFiUdp.h>
 #include "Station.h"
 #include "PacketDecoder.h"
+#include "ForwardErrorCorrection.h"
+#include "Uplink.h"
+#include "Export.h"
+#include "JitterBuffer.h"
 #include "GfxGraphing.h"
 #include "SmartTextField.h"
 
@@ -40,27 +44,64 @@
 // #define DEBUG_PRINT
 // #define DEBUG_PRINT_SHOW_DATA_DETAILS
 
+// UPLINK_ENABLED will join the UPLINK_SSID network (while still providing
+// the soft AP for the nodes) and send per-station rollups to the collector
+// at uplinkCollectorIP:uplinkCollectorPort.  See Uplink.h.  Note that the
+// ESP8266 moves the soft AP to whatever channel the upstream network is on.
+// While the station interface is searching for the upstream network the soft
+// AP drops in and out (see the comment in setup) so it only tries to join
+// once every UPLINK_RECONNECT_INTERVAL_MS.  Expect some lost node packets
+// around each attempt while the upstream network is unreachable.
+// #define UPLINK_ENABLED
+#define UPLINK_SSID "AMS-uplink"
+#define UPLINK_PASSWORD NULL
+#define UPLINK_RECONNECT_INTERVAL_MS 60000
+// Rollups are bucketed by the capture time of each sample, which trails the
+// time it is released from the jitter buffer by up to a packet period plus
+// the playout delay.  Each frame is held open this long past its end so that
+// every station's samples for it are in before it is sent.  This allows for
+// twice the period of the node's 16 sample packets and must stay below
+// UPLINK_FRAME_INTERVAL_MS.
+#define UPLINK_FRAME_HOLD_MS \
+  (JITTER_MAX_PLAYOUT_DELAY_MS + 2 * 16 * NODE_SAMPLE_DURATION_MS)
+IPAddress uplinkCollectorIP(192,168,1,10);
+unsigned int uplinkCollectorPort = 8890;
+
 // Keeping things simple with a maximum number of stations that are tracked with this instance.
 #define MAX_NUMBER_STATIONS 4
 Station stations[MAX_NUMBER_STATIONS];
+FECState fecStates[MAX_NUMBER_STATIONS];
+UplinkRollup uplinkRollups[MAX_NUMBER_STATIONS];
+// Samples captured after the end of the frame that is being held open.
+UplinkRollup uplinkNextRollups[MAX_NUMBER_STATIONS];
+JitterBuffer jitterBuffers[MAX_NUMBER_STATIONS];
 
 const char *ssid = "AMS-server";
 unsigned int localUDPPort = 8888;
+// Parity packets for forward error correction arrive on their own port.  See
+// ForwardErrorCorrection.h.
+unsigned int localFECUDPPort = 8889;
 
 // Graphical elements
 SegmentedBarGraph *g[MAX_NUMBER_STATIONS];
 SmartTextField<int> *connTextField;
 SmartTextField<int> *packetsTextField;
+SmartTextField<int> *alertTextFields[MAX_NUMBER_STATIONS];
 
 // Allocate buffers for sending and receiving UDP data.
 // The maximum UDP packet size is defined in https://github.com/esp8266/Arduino/blob/master/libraries/ESP8266WiFi/src/WiFiUdp.h
 // and, as of 1/22/2020, is 8k.  
 byte incomingPacket[UDP_TX_PACKET_MAX_SIZE+1]; 
+byte incomingParityPacket[FEC_HEADER_SIZE + FEC_MAX_PAYLOAD_SIZE + 1];
+byte recoveredPacket[HEADER_SIZE + FEC_MAX_PAYLOAD_SIZE];
+byte uplinkFrame[UPLINK_FRAME_SIZE(MAX_NUMBER_STATIONS)];
 
 // An HTTP server exists for diagnostic and debugging purposes
 ESP8266WebServer server(80);
+ExportWriter exportWriter;
 
 WiFiUDP Udp;
+WiFiUDP FecUdp;
 Adafruit_ILI9341 tft = Adafruit_ILI9341(TFT_CS, TFT_DC);
 Adafruit_STMPE610 ts = Adafruit_STMPE610(STMPE_CS);
 
@@ -68,6 +109,10 @@ Adafruit_STMPE610 ts = Adafruit_STMPE610(STMPE_CS);
 #define RENDER_FRAME_DELAY_MS 30
 uint32_t lastGraphRenderTime = 0;
 
+uint32_t uplinkFrameStartTime = 0;
+uint16_t uplinkFrameSequence = 0;
+uint32_t uplinkConnectAttemptTime = 0;
+
 void setup() {
   Serial.begin(57600);
 
@@ -86,7 +131,16 @@ void setup() {
   // library.
   WiFi.setAutoConnect(false);
   WiFi.persistent(false);
+#ifdef UPLINK_ENABLED
+  WiFi.mode(WIFI_AP_STA);
+  // Reconnecting is left to handleUplink so that an unreachable upstream
+  // network doesn't keep the station interface searching.
+  WiFi.setAutoReconnect(false);
+  WiFi.begin(UPLINK_SSID, UPLINK_PASSWORD);
+  uplinkConnectAttemptTime = millis();
+#else
   WiFi.mode(WIFI_AP);
+#endif
 
   // Create a soft access point for the stations to connect to.
   bool result = WiFi.softAP(
@@ -110,8 +164,12 @@ void setup() {
 
   // Start listening for packets on the UDP port.
   Udp.begin(localUDPPort);
+  FecUdp.begin(localFECUDPPort);
     
   server.on("/", handleRoot);
+  server.on("/export", handleExport);
+  server.on("/jitter", handleJitter);
+  server.on("/stats", handleStats);
   server.begin();
   Serial.println("HTTP server started");
 
@@ -125,13 +183,28 @@ void setup() {
 
   for (int i=0; i<MAX_NUMBER_STATIONS; i++) { 
     initializeStation(stations[i]);
+    initializeFECState(fecStates[i]);
+    resetUplinkRollup(uplinkRollups[i]);
+    resetUplinkRollup(uplinkNextRollups[i]);
+    initializeJitterBuffer(jitterBuffers[i]);
     g[i] = new SegmentedBarGraph( tft, XOFFSET + (SEGMENTSIZE * i) + ((SEGMENTSIZE - 2*24)/2), 32, 24, 152 );
     g[i]->setBackgroundColor(ILI9341_BLACK);
     g[i]->setBorderColor(ILI9341_WHITE);
     g[i]->setMinAndMaxYAxisValues(0, 1024);
     g[i]->setSegmentGroupColors(ILI9341_GREEN, ILI9341_YELLOW, ILI9341_RED);
     g[i]->startGraphing();
+
+    // The number of times an alert has fired for the station is shown below
+    // its graph.
+    alertTextFields[i] = new SmartTextField<int>(tft,
+        XOFFSET + (SEGMENTSIZE * i) + ((SEGMENTSIZE - 2*24)/2), 192, 24, 8,
+        ILI9341_BLACK);
   }
+
+  // Alert when a station is loud for a sustained period.  The alert clears
+  // once the level has dropped back down a bit.  See Alerting.h.
+  configureAlertRule(0, 700, 600, 3000);
+  configureAlertRule(1, 900, 800, 500);
   for (int i=0; i<(MAX_NUMBER_STATIONS-1); i++) { 
     tft.drawFastVLine(XOFFSET + (SEGMENTSIZE * i) + 46, 22, 210, ILI9341_RED);
   }
@@ -141,6 +214,110 @@ void handleRoot() {
   server.send(200, "text/html", "<h1>You are connected</h1>");
 }
 
+// Sends one chunk of an export and then handles any packets that arrived
+// while it was being built so that a long export doesn't cause packet loss.
+void sendExportChunk(const char *data, size_t length) {
+  server.sendContent(data, length);
+  handleUDPPacket();
+  handleFECPacket();
+  releaseJitterBuffers(millis());
+}
+
+// Streams the data held for the stations using chunked transfer encoding.
+//   /export?format=csv (default) or /export?format=binary
+//   &station=<index> limits the export to a single station slot.
+// See Export.h for the formats.
+void handleExport() {
+  bool binary = server.arg("format") == "binary";
+  int firstStation = 0;
+  int lastStation = MAX_NUMBER_STATIONS - 1;
+  if (server.hasArg("station")) {
+    firstStation = lastStation = server.arg("station").toInt();
+    if (firstStation < 0 || firstStation >= MAX_NUMBER_STATIONS) {
+      server.send(400, "text/plain", "Unknown station index");
+      return;
+    }
+  }
+
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, binary ? "application/octet-stream" : "text/csv", "");
+
+  initializeExportWriter(exportWriter, sendExportChunk);
+  if (!binary) {
+    writeExportCSVHeader(exportWriter);
+  }
+  for (int i=firstStation; i<=lastStation; i++) {
+    if (stations[i].id == NO_STATION_ALLOCATED) {
+      continue;
+    }
+    if (binary) {
+      exportStationBinary(exportWriter, stations[i]);
+    } else {
+      exportStationCSV(exportWriter, stations[i]);
+    }
+  }
+  flushExportWriter(exportWriter);
+
+  // An empty chunk ends the chunked response.
+  server.sendContent("");
+}
+
+// Reports the running statistics and alert state for each station.  The
+// mean and standard deviation cover every data point seen for the station.
+// Times are in milliseconds.
+void handleStats() {
+  String result = "station,dataPoints,mean,stdDev,movingAverage";
+  for (int r=0; r<MAX_ALERT_RULES; r++) { 
+    char column[64];
+    snprintf(column, sizeof(column), ",alert%dActive,alert%dTriggers,alert%dTimeAbove",
+        r, r, r);
+    result += column;
+  }
+  result += "\n";
+
+  for (int i=0; i<MAX_NUMBER_STATIONS; i++) { 
+    if (stations[i].id == NO_STATION_ALLOCATED) {
+      continue;
+    }
+    const StationStatistics &st = stations[i].statistics;
+    char line[64];
+    snprintf(line, sizeof(line), "%u,%lu,%.1f,%.1f,%.1f", stations[i].id,
+        (unsigned long) st.count, st.mean, sqrt(getStationVariance(st)),
+        st.movingAverage);
+    result += line;
+    for (int r=0; r<MAX_ALERT_RULES; r++) { 
+      snprintf(line, sizeof(line), ",%d,%lu,%lu", st.alerts[r].active,
+          (unsigned long) st.alerts[r].triggerCount,
+          (unsigned long) st.alerts[r].totalTimeAboveMillis);
+      result += line;
+    }
+    result += "\n";
+  }
+  server.send(200, "text/plain", result);
+}
+
+// Reports the jitter buffer statistics for each station.  Times are in
+// milliseconds.
+void handleJitter() {
+  String result = "station,packets,packetPeriod,jitter,maxDeviation,"
+    "playoutDelay,buffered,late,overflow,resyncs\n";
+  for (int i=0; i<MAX_NUMBER_STATIONS; i++) { 
+    if (stations[i].id == NO_STATION_ALLOCATED) {
+      continue;
+    }
+    const JitterBuffer &j = jitterBuffers[i];
+    char line[128];
+    snprintf(line, sizeof(line), "%u,%lu,%.1f,%.1f,%lu,%lu,%u,%lu,%lu,%lu\n",
+        stations[i].id, (unsigned long) j.packetCount, j.packetPeriodMillis,
+        j.jitterMillis, (unsigned long) j.maxDeviationMillis,
+        (unsigned long) j.playoutDelayMillis, j.count,
+        (unsigned long) j.lateSampleCount, (unsigned long) j.overflowSampleCount,
+        (unsigned long) j.resyncCount);
+    result += line;
+  }
+  server.send(200, "text/plain", result);
+}
+
 void displayWelcome() {
   tft.fillScreen(ILI9341_BLACK);
   tft.setCursor(0, 0); tft.setTextColor(ILI9341_RED); tft.setTextSize(2);
@@ -158,6 +335,58 @@ void displayWelcome() {
 
 int numberOfPacketsReceived = 0;
 
+// Queues the samples of a valid (received or recovered) packet in the
+// jitter buffer for the station.  They are released to the station storage
+// and graph by releaseJitterBuffers.
+void processPacketSamples(int stationIndex, PacketData &p, uint32_t currentTime) {
+#ifdef DEBUG_PRINT_SHOW_DATA_DETAILS
+  for (int i=0; i < p.sampleCount; i++) { 
+    Serial.printf("handleUDPPacket; currentTime: %d, ID: %d, "
+        "stationIndex: %d, packetNumber: %d, dataIndex: %d, data: %d\n", 
+        currentTime, p.packetSenderID, stationIndex, p.packetNumber, i,
+        p.samples[i]);
+  }
+#endif
+  addJitterBufferPacket(jitterBuffers[stationIndex], p, currentTime);
+}
+
+// Adds a released sample to the uplink frame that covers its capture time.
+// Samples from a frame that was already sent are left out.
+void addUplinkSample(int stationIndex, uint16_t value, uint32_t captureTime) {
+  int32_t offset = (int32_t)(captureTime - uplinkFrameStartTime);
+  if (offset < 0) {
+    return;
+  }
+  if (offset < UPLINK_FRAME_INTERVAL_MS) {
+    addUplinkSamples(uplinkRollups[stationIndex], &value, 1, captureTime,
+        uplinkFrameStartTime);
+  } else {
+    addUplinkSamples(uplinkNextRollups[stationIndex], &value, 1, captureTime,
+        uplinkFrameStartTime + UPLINK_FRAME_INTERVAL_MS);
+  }
+}
+
+// Hands every sample that is due from the jitter buffers to the station
+// storage and the uplink (stamped with its inferred capture time) and the
+// graphs.
+void releaseJitterBuffers(uint32_t currentTime) {
+  uint16_t released[JITTER_BUFFER_CAPACITY];
+  for (int i=0; i<MAX_NUMBER_STATIONS; i++) { 
+    uint16_t n = 0;
+    uint16_t value;
+    uint32_t captureTime;
+    PacketNumber packetNumber;
+    while (releaseJitterBufferSample(jitterBuffers[i], currentTime, value,
+          captureTime, packetNumber)) {
+      addDataPoint(stations[i], value, packetNumber, captureTime);
+      addUplinkSample(i, value, captureTime);
+      released[n++] = value;
+    }
+    // The graph works off of the time that values are shown.
+    g[i]->addDatasetValues(released, n, currentTime);
+  }
+}
+
 int handleUDPPacket() {
   int packetsProcessed = 0;
   int packetSize = Udp.parsePacket();
@@ -192,26 +421,25 @@ int handleUDPPacket() {
     } 
 
     if (stationIndex >= 0) { 
-      if ( !isPacketValid(stations[stationIndex], p.packetNumber) ) { 
+      if (isFECPacketRecovered(fecStates[stationIndex], p.packetNumber)) {
+        // The packet was already rebuilt from a parity packet that was
+        // handled before this (delayed) original.
+        Serial.printf("handleUDPPacket - packet already recovered, discarding; "
+            "ID: %d, stationIndex: %d, packetNumber: %d\n",
+            p.packetSenderID, stationIndex, p.packetNumber);
+      } else if ( !isPacketValid(stations[stationIndex], p.packetNumber) ) { 
         Serial.printf("handleUDPPacket - invalid packet seen, discarding; IP: %s, "
             "ID: %d, stationIndex: %d, packetNumber: %d, datapoints: %d\n",
             sender.toString().c_str(), p.packetSenderID, stationIndex, p.packetNumber, 
             p.sampleCount);
+        uplinkRollups[stationIndex].invalidPacketCount++;
       } else { 
         Serial.printf("handleUDPPacket - valid packet seen; ID: %d, "
             "packetNumber: %d, datapoints: %d\n",
             p.packetSenderID, p.packetNumber, p.sampleCount);
-        for (int i=0; i < p.sampleCount; i++) { 
-#ifdef DEBUG_PRINT_SHOW_DATA_DETAILS
-          Serial.printf("handleUDPPacket; currentTime: %d, IP: %s, ID: %d, "
-              "stationIndex: %d, packetNumber: %d, dataIndex: %d, data: %d\n", 
-              currentTime, sender.toString().c_str(),
-              p.packetSenderID, stationIndex, p.packetNumber, i,
-              p.samples[i]);
-#endif
-          addDataPoint(stations[stationIndex], p.packetNumber, p.samples[i], currentTime);
-          g[stationIndex]->addDatasetValue(p.samples[i]);
-        }
+        recordFECDataPacket(fecStates[stationIndex], incomingPacket, n);
+        uplinkRollups[stationIndex].packetCount++;
+        processPacketSamples(stationIndex, p, currentTime);
       }
     } else {
       Serial.println("handleUDPPacket - discarding data due to all station slots full");
@@ -222,22 +450,121 @@ int handleUDPPacket() {
   return packetsProcessed;
 }
 
+// Parity packets let us rebuild a single lost data packet out of each group
+// of FEC_GROUP_SIZE packets.  See ForwardErrorCorrection.h.
+int handleFECPacket() {
+  int packetsProcessed = 0;
+  int packetSize = FecUdp.parsePacket();
+  while (packetSize > 0 && packetsProcessed < 10) { 
+    uint32_t currentTime = millis();
+
+    // Parity packets are small so only that much is read.  Anything beyond
+    // is discarded by the next parsePacket.
+    memset(incomingParityPacket, 0, sizeof(incomingParityPacket));
+    int n = FecUdp.read(incomingParityPacket, FEC_HEADER_SIZE + FEC_MAX_PAYLOAD_SIZE);
+
+    StationIdentifier id = incomingParityPacket[FEC_SENDER_LOC];
+    int stationIndex = findStation(stations, MAX_NUMBER_STATIONS, id);
+    if (stationIndex >= 0) {
+      int recoveredLength = recoverFECPacket(fecStates[stationIndex],
+          incomingParityPacket, n, recoveredPacket);
+      if (recoveredLength > 0) {
+        PacketData p;
+        decodePacket(p, recoveredPacket, recoveredLength);
+        Serial.printf("handleFECPacket - recovered lost packet; ID: %d, "
+            "packetNumber: %d, datapoints: %d, recoveredTotal: %d\n",
+            p.packetSenderID, p.packetNumber, p.sampleCount,
+            fecStates[stationIndex].recoveredPacketCount);
+        uplinkRollups[stationIndex].recoveredPacketCount++;
+        processPacketSamples(stationIndex, p, currentTime);
+      }
+    }
+    packetsProcessed++;
+    packetSize = FecUdp.parsePacket();
+  }
+  return packetsProcessed;
+}
+
+// Once every UPLINK_FRAME_INTERVAL_MS the station rollups are sent to the
+// collector (when UPLINK_ENABLED) and a new frame is started.  Frames cover
+// capture times and are sent UPLINK_FRAME_HOLD_MS after they end.
+void handleUplink(uint32_t currentTime) {
+  if (currentTime - uplinkFrameStartTime <
+      UPLINK_FRAME_INTERVAL_MS + UPLINK_FRAME_HOLD_MS) {
+    return;
+  }
+
+#ifdef UPLINK_ENABLED
+  if (WiFi.status() != WL_CONNECTED) {
+    if (currentTime - uplinkConnectAttemptTime >= UPLINK_RECONNECT_INTERVAL_MS) {
+      Serial.println("handleUplink - not connected, retrying the upstream network");
+      WiFi.begin(UPLINK_SSID, UPLINK_PASSWORD);
+      uplinkConnectAttemptTime = currentTime;
+    }
+  } else {
+    int n = encodeUplinkFrame(uplinkFrame, ESP.getChipId(), uplinkFrameSequence,
+        uplinkFrameStartTime, currentTime, stations, uplinkRollups,
+        MAX_NUMBER_STATIONS);
+    Udp.beginPacket(uplinkCollectorIP, uplinkCollectorPort);
+    Udp.write(uplinkFrame, n);
+    Udp.endPacket();
+#ifdef DEBUG_PRINT
+    Serial.printf("handleUplink - sent frame; sequence: %d, bytes: %d\n",
+        uplinkFrameSequence, n);
+#endif
+  }
+#endif
+
+  // The sequence moves on even when the frame couldn't be sent so that the
+  // collector can count the frames that it missed.
+  uplinkFrameSequence++;
+  uplinkFrameStartTime += UPLINK_FRAME_INTERVAL_MS;
+  bool resynchronize = currentTime - uplinkFrameStartTime >=
+    UPLINK_FRAME_INTERVAL_MS + UPLINK_FRAME_HOLD_MS;
+  if (resynchronize) {
+    // The loop fell behind (at startup or during a long export) so start
+    // over from the capture times that are being released now.
+    uplinkFrameStartTime = currentTime - UPLINK_FRAME_HOLD_MS;
+  }
+  for (int i=0; i<MAX_NUMBER_STATIONS; i++) {
+    // The next frame's samples (and no packet counts) carry over.
+    if (resynchronize) {
+      resetUplinkRollup(uplinkRollups[i]);
+    } else {
+      uplinkRollups[i] = uplinkNextRollups[i];
+    }
+    resetUplinkRollup(uplinkNextRollups[i]);
+  }
+}
+
 void renderStats() {
   tft.setTextColor(ILI9341_WHITE); 
   tft.setTextSize(1);
   connTextField->render(WiFi.softAPgetStationNum());
   packetsTextField->render(numberOfPacketsReceived);
+  for (int i=0; i<MAX_NUMBER_STATIONS; i++) { 
+    alertTextFields[i]->render(getAlertTriggerCount(stations[i].statistics));
+  }
 }
 
 void loop() {
   uint32_t currentTime = millis();
 
   handleUDPPacket();
+  handleFECPacket();
+  releaseJitterBuffers(millis());
+  handleUplink(currentTime);
+  server.handleClient();
 
   uint32_t elapsedTime = currentTime - lastGraphRenderTime;
   if (elapsedTime > RENDER_FRAME_DELAY_MS) { 
     lastGraphRenderTime = currentTime;
     for (int i=0; i<MAX_NUMBER_STATIONS; i++) { 
+      // Data points carry their capture time which trails the current time
+      // by the jitter buffer's delay.
+      ageStationStatistics(stations[i].statistics,
+          currentTime - getJitterDelay(jitterBuffers[i]));
+      g[i]->setAlertActive(isAnyAlertActive(stations[i].statistics));
       g[i]->render();
     }
   }
@@ -15,6 +15,8 @@
 #ifndef STATION_H
 #define STATION_H
 
+#include "Alerting.h"
+
 // The amount of time which can separate two datapoints where the two
 // time periods are considered the same.  So, if time t1 and t2 are separated
 // by at most TIME_DISCRETIZE_UNIT_MS then they will be considered the
@@ -24,6 +26,11 @@
 // The maximum number of datapoints that will be tracked per station and
 // maintained in memory.
 #define MAX_DATA_POINTS 100
+
+// A longer, coarser history is also kept for each station.  It holds the
+// maximum value seen in each TIME_DISCRETIZE_UNIT_MS bucket for the most
+// recent HISTORY_BUCKET_COUNT buckets (one minute).
+#define HISTORY_BUCKET_COUNT 600
 #define NO_STATION_ALLOCATED 255
 #define INVALID_PACKET_NUMBER_RANGE 5
 #define MAX_PACKET_NUMBER 255
@@ -42,6 +49,13 @@ struct Station {
   uint32_t lastNonzeroDataPointTime;
   uint32_t invalidPacketCount;
   PacketNumber lastPacketNumber;
+
+  uint16_t historyMaxValues[HISTORY_BUCKET_COUNT];
+  uint16_t historyNewestIndex;
+  uint16_t historyBucketCount;
+  uint32_t historyNewestBucketTime;
+
+  StationStatistics statistics;
 };
 
 void initializeStation(Station &s, const StationIdentifier id) {
@@ -56,6 +70,14 @@ void initializeStation(Station &s, const StationIdentifier id) {
   s.lastNonzeroDataPointTime = 0;
   s.invalidPacketCount = 0;
   s.lastPacketNumber = 0;
+
+  for (int i=0; i<HISTORY_BUCKET_COUNT; i++) {
+    s.historyMaxValues[i] = 0;
+  }
+  s.historyNewestIndex = 0;
+  s.historyBucketCount = 0;
+  s.historyNewestBucketTime = 0;
+  initializeStationStatistics(s.statistics);
 }
 
 void initializeStation(Station &s) {
@@ -126,6 +148,45 @@ bool isPacketValid(Station &s, const PacketNumber p) {
   return true;
 }
 
+// Folds a data point into the bucketed history.  Moving on to a new bucket
+// clears any buckets that were skipped over since no data arrived for them.
+void addHistoryDataPoint(Station &s, uint16_t value, uint32_t time) {
+  uint32_t bucketTime = time - (time % TIME_DISCRETIZE_UNIT_MS);
+
+  if (s.historyBucketCount == 0) {
+    s.historyNewestIndex = 0;
+    s.historyNewestBucketTime = bucketTime;
+    s.historyMaxValues[0] = value;
+    s.historyBucketCount = 1;
+    return;
+  }
+
+  int32_t bucketOffset = ((int32_t)(bucketTime - s.historyNewestBucketTime)) /
+    TIME_DISCRETIZE_UNIT_MS;
+  if (bucketOffset > 0) {
+    int steps = bucketOffset > HISTORY_BUCKET_COUNT ? HISTORY_BUCKET_COUNT : bucketOffset;
+    for (int i=0; i<steps; i++) {
+      s.historyNewestIndex = (s.historyNewestIndex + 1) % HISTORY_BUCKET_COUNT;
+      s.historyMaxValues[s.historyNewestIndex] = 0;
+    }
+    s.historyBucketCount += bucketOffset;
+    if (bucketOffset >= HISTORY_BUCKET_COUNT || s.historyBucketCount > HISTORY_BUCKET_COUNT) {
+      s.historyBucketCount = HISTORY_BUCKET_COUNT;
+    }
+    s.historyNewestBucketTime = bucketTime;
+    bucketOffset = 0;
+  }
+
+  // A late data point can still update an older bucket if it is retained.
+  if (-bucketOffset < s.historyBucketCount) {
+    int index = (s.historyNewestIndex + HISTORY_BUCKET_COUNT + bucketOffset) %
+      HISTORY_BUCKET_COUNT;
+    if (value > s.historyMaxValues[index]) {
+      s.historyMaxValues[index] = value;
+    }
+  }
+}
+
 void addDataPoint(Station &s, uint16_t value, PacketNumber p, uint32_t time) {
   if (s.indexOfNextDataPoint == MAX_DATA_POINTS) {
     s.indexOfNextDataPoint = 0;
@@ -140,6 +201,9 @@ void addDataPoint(Station &s, uint16_t value, PacketNumber p, uint32_t time) {
   if (value!=0 && time > s.lastNonzeroDataPointTime) {
     s.lastNonzeroDataPointTime = time;
   }
+
+  addHistoryDataPoint(s, value, time);
+  updateStationStatistics(s.statistics, value, time);
 }
 
 
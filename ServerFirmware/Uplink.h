@@ -0,0 +1,195 @@
+// Uplink.h
+//
+// A server can forward what it sees to an upstream collector so that several
+// servers (say one per room) can be viewed together.  Rather than forwarding
+// every sample the server keeps a small rollup for each station holding the
+// min/max/average of the samples for each TIME_DISCRETIZE_UNIT_MS bucket
+// along with some health counters.  Once every UPLINK_FRAME_INTERVAL_MS the
+// rollups for all of the stations are encoded into a single compact frame,
+// sent upstream and reset.  The upstream traffic then depends on the number
+// of stations and not on the number of samples they send.
+//
+// See UplinkCollector/uplinkCollector.py for the receiving side.
+
+#ifndef UPLINK_H
+#define UPLINK_H
+
+// This requires Station.h for TIME_DISCRETIZE_UNIT_MS and the station types.
+#include "Station.h"
+
+#define UPLINK_FRAME_INTERVAL_MS 1000
+#define UPLINK_BUCKETS_PER_FRAME (UPLINK_FRAME_INTERVAL_MS / TIME_DISCRETIZE_UNIT_MS)
+
+#define UPLINK_MAGIC 0xA5
+#define UPLINK_VERSION 1
+
+// Sizes, in bytes, of the pieces of a frame.
+#define UPLINK_HEADER_SIZE 20
+#define UPLINK_BUCKET_SIZE 7
+#define UPLINK_STATION_HEADER_SIZE 8
+#define UPLINK_STATION_SIZE \
+  (UPLINK_STATION_HEADER_SIZE + UPLINK_BUCKETS_PER_FRAME * UPLINK_BUCKET_SIZE)
+#define UPLINK_FRAME_SIZE(numberOfStations) \
+  (UPLINK_HEADER_SIZE + (numberOfStations) * UPLINK_STATION_SIZE)
+
+//
+// Frame structure, all multi-byte values are little endian.
+//
+// 0           7 8         15 16        23 24        31
+// +------------+------------+------------+------------+
+// | Magic      | Version    | Stations   | Buckets    |
+// +------------+------------+------------+------------+
+// |                    Server ID                      |
+// +------------+------------+------------+------------+
+// |     Frame Sequence      |      Bucket Millis      |
+// +------------+------------+------------+------------+
+// |                Frame Start Millis                 |
+// +------------+------------+------------+------------+
+// |                   Send Millis                     |
+// +------------+------------+------------+------------+
+// |               Station 1 ... Station N             |
+//            ...
+//
+// Each station is:
+//
+// 0           7 8         15 16        23 24        31
+// +------------+------------+------------+------------+
+// | Station ID | Reserved   |        Packets          |
+// +------------+------------+------------+------------+
+// |     Invalid Packets     |   Recovered Packets     |
+// +------------+------------+------------+------------+
+// |  Buckets  ...
+//
+// followed by 'Buckets' buckets of 7 bytes each, oldest first:
+//
+// 0           7 8         15 16        23 24        31          39        47          55
+// +------------+------------+------------+------------+-----------+-----------+-----------+
+// | Count      |          Min            |          Max           |        Average        |
+// +------------+------------+------------+------------+-----------+-----------+-----------+
+//
+// The millis values are from the server's clock.  Bucket i covers
+// [Frame Start + i * Bucket Millis, Frame Start + (i+1) * Bucket Millis) and
+// the collector uses Send Millis to line that up with its own clock.  The
+// packet counters only cover the time since the prior frame.
+
+struct UplinkBucket {
+  uint16_t count;
+  uint16_t minValue;
+  uint16_t maxValue;
+  uint32_t sum;
+};
+
+struct UplinkRollup {
+  UplinkBucket buckets[UPLINK_BUCKETS_PER_FRAME];
+  uint16_t packetCount;
+  uint16_t invalidPacketCount;
+  uint16_t recoveredPacketCount;
+};
+
+void resetUplinkRollup(UplinkRollup &r) {
+  for (int i=0; i<UPLINK_BUCKETS_PER_FRAME; i++) {
+    r.buckets[i].count = 0;
+    r.buckets[i].minValue = 0;
+    r.buckets[i].maxValue = 0;
+    r.buckets[i].sum = 0;
+  }
+  r.packetCount = 0;
+  r.invalidPacketCount = 0;
+  r.recoveredPacketCount = 0;
+}
+
+/**
+ * Adds n samples that were all seen at the same time to the rollup.
+ * frameStartMillis is the start time of the frame currently being built.
+ * Samples from before the frame are put in the first bucket and samples
+ * from after it (if sending a frame was delayed) are put in the last bucket.
+ */
+void addUplinkSamples(UplinkRollup &r, const uint16_t *samples, uint16_t n,
+    uint32_t time, uint32_t frameStartMillis) {
+  int32_t offset = (int32_t)(time - frameStartMillis);
+  int index = 0;
+  if (offset > 0) {
+    index = offset / TIME_DISCRETIZE_UNIT_MS;
+  }
+  if (index >= UPLINK_BUCKETS_PER_FRAME) {
+    index = UPLINK_BUCKETS_PER_FRAME - 1;
+  }
+
+  UplinkBucket &b = r.buckets[index];
+  for (uint16_t i=0; i<n; i++) {
+    uint16_t v = samples[i];
+    if (b.count == 0 || v < b.minValue) {
+      b.minValue = v;
+    }
+    if (b.count == 0 || v > b.maxValue) {
+      b.maxValue = v;
+    }
+    b.sum += v;
+    if (b.count < 0xFFFF) {
+      b.count++;
+    }
+  }
+}
+
+void writeUplinkUint16(byte *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+}
+
+void writeUplinkUint32(byte *p, uint32_t v) {
+  writeUplinkUint16(p, v & 0xFFFF);
+  writeUplinkUint16(p + 2, (v >> 16) & 0xFFFF);
+}
+
+/**
+ * Encodes the rollups of every allocated station into frame, which must be
+ * able to hold UPLINK_FRAME_SIZE(numberOfStations) bytes, and returns the
+ * number of bytes used.
+ */
+int encodeUplinkFrame(byte *frame, uint32_t serverID, uint16_t frameSequence,
+    uint32_t frameStartMillis, uint32_t sendMillis, const Station *s,
+    const UplinkRollup *rollups, int numberOfStations) {
+  int stationCount = 0;
+  byte *p = frame + UPLINK_HEADER_SIZE;
+
+  for (int i=0; i<numberOfStations; i++) {
+    if (s[i].id == NO_STATION_ALLOCATED) {
+      continue;
+    }
+    const UplinkRollup &r = rollups[i];
+    p[0] = s[i].id;
+    p[1] = 0;
+    writeUplinkUint16(p + 2, r.packetCount);
+    writeUplinkUint16(p + 4, r.invalidPacketCount);
+    writeUplinkUint16(p + 6, r.recoveredPacketCount);
+    p += UPLINK_STATION_HEADER_SIZE;
+
+    for (int j=0; j<UPLINK_BUCKETS_PER_FRAME; j++) {
+      const UplinkBucket &b = r.buckets[j];
+      uint16_t average = 0;
+      if (b.count > 0) {
+        average = b.sum / b.count;
+      }
+      p[0] = b.count > 0xFF ? 0xFF : b.count;
+      writeUplinkUint16(p + 1, b.minValue);
+      writeUplinkUint16(p + 3, b.maxValue);
+      writeUplinkUint16(p + 5, average);
+      p += UPLINK_BUCKET_SIZE;
+    }
+    stationCount++;
+  }
+
+  frame[0] = UPLINK_MAGIC;
+  frame[1] = UPLINK_VERSION;
+  frame[2] = stationCount;
+  frame[3] = UPLINK_BUCKETS_PER_FRAME;
+  writeUplinkUint32(frame + 4, serverID);
+  writeUplinkUint16(frame + 8, frameSequence);
+  writeUplinkUint16(frame + 10, TIME_DISCRETIZE_UNIT_MS);
+  writeUplinkUint32(frame + 12, frameStartMillis);
+  writeUplinkUint32(frame + 16, sendMillis);
+
+  return p - frame;
+}
+
+#endif
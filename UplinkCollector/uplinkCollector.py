@@ -0,0 +1,192 @@
+
+# Collector for the per-station rollups that servers send when built with
+# UPLINK_ENABLED.  See ServerFirmware/Uplink.h for the frame layout.
+#
+# Frames from any number of servers are merged into one view keyed by
+# (server, station).  Every few seconds a table of the most recent second for
+# each station is printed along with the health counters.  Optionally every
+# bucket is also appended to a CSV file.
+#
+# Usage:
+#   python uplinkCollector.py [port] [csvFile]
+#
+# To try it out without any hardware run this and, in another terminal,
+# test/sendExampleUplinkFrames.py.
+#
+
+import socket
+import struct
+import sys
+import time
+
+UPLINK_MAGIC = 0xA5
+UPLINK_VERSION = 1
+
+HEADER_FORMAT = '<BBBBIHHII'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+STATION_HEADER_FORMAT = '<BBHHH'
+STATION_HEADER_SIZE = struct.calcsize(STATION_HEADER_FORMAT)
+BUCKET_FORMAT = '<BHHH'
+BUCKET_SIZE = struct.calcsize(BUCKET_FORMAT)
+
+REPORT_INTERVAL_SECONDS = 2
+
+def decodeFrame(data):
+    # Returns the header fields and a list of stations or None if the frame
+    # is not one we understand.
+    if len(data) < HEADER_SIZE:
+        return None
+    (magic, version, stationCount, bucketCount, serverID, frameSequence,
+            bucketMillis, frameStartMillis, sendMillis) = struct.unpack_from(
+                    HEADER_FORMAT, data, 0)
+    if magic != UPLINK_MAGIC or version != UPLINK_VERSION:
+        return None
+    if len(data) < HEADER_SIZE + stationCount * (STATION_HEADER_SIZE +
+            bucketCount * BUCKET_SIZE):
+        return None
+
+    stations = []
+    offset = HEADER_SIZE
+    for _ in range(stationCount):
+        (stationID, _, packets, invalidPackets, recoveredPackets) = \
+                struct.unpack_from(STATION_HEADER_FORMAT, data, offset)
+        offset += STATION_HEADER_SIZE
+        buckets = []
+        for _ in range(bucketCount):
+            buckets.append(struct.unpack_from(BUCKET_FORMAT, data, offset))
+            offset += BUCKET_SIZE
+        stations.append({
+            'id': stationID,
+            'packets': packets,
+            'invalidPackets': invalidPackets,
+            'recoveredPackets': recoveredPackets,
+            'buckets': buckets,
+        })
+
+    return {
+        'serverID': serverID,
+        'frameSequence': frameSequence,
+        'bucketMillis': bucketMillis,
+        'frameStartMillis': frameStartMillis,
+        'sendMillis': sendMillis,
+        'stations': stations,
+    }
+
+class Collector:
+
+    def __init__(self, csvFile):
+        self.servers = {}
+        self.stations = {}
+        self.csvFile = csvFile
+
+    def handleFrame(self, frame, sender, arrivalTime):
+        serverID = frame['serverID']
+        server = self.servers.setdefault(serverID, {
+            'address': sender[0], 'frames': 0, 'missedFrames': 0,
+            'lastSequence': None})
+        if server['lastSequence'] is not None:
+            gap = (frame['frameSequence'] - server['lastSequence']) % 65536
+            if gap > 1:
+                server['missedFrames'] += gap - 1
+        server['lastSequence'] = frame['frameSequence']
+        server['frames'] += 1
+        server['address'] = sender[0]
+
+        for s in frame['stations']:
+            key = (serverID, s['id'])
+            station = self.stations.setdefault(key, {
+                'packets': 0, 'invalidPackets': 0, 'recoveredPackets': 0,
+                'lastSecond': None, 'lastSeen': 0})
+            station['packets'] += s['packets']
+            station['invalidPackets'] += s['invalidPackets']
+            station['recoveredPackets'] += s['recoveredPackets']
+            station['lastSeen'] = arrivalTime
+
+            # Combine the buckets of the frame into a single summary of the
+            # last second for the table.
+            count = 0
+            total = 0
+            low = None
+            high = None
+            for i, (c, minValue, maxValue, average) in enumerate(s['buckets']):
+                if c == 0:
+                    continue
+                count += c
+                total += c * average
+                low = minValue if low is None else min(low, minValue)
+                high = maxValue if high is None else max(high, maxValue)
+                if self.csvFile:
+                    self.writeBucket(frame, s['id'], i, arrivalTime,
+                            (c, minValue, maxValue, average))
+            if count:
+                station['lastSecond'] = (count, low, high, total // count)
+            else:
+                station['lastSecond'] = None
+
+    def writeBucket(self, frame, stationID, index, arrivalTime, bucket):
+        # Line the server's clock up with ours using the time it sent the
+        # frame.  This ignores the (small) network delay.
+        bucketStart = frame['frameStartMillis'] + index * frame['bucketMillis']
+        wallTime = arrivalTime - ((frame['sendMillis'] - bucketStart) % 2**32) / 1000.0
+        self.csvFile.write("{:.3f},{:x},{},{},{},{},{}\n".format(wallTime,
+            frame['serverID'], stationID, *bucket))
+
+    def report(self, now):
+        print("{} servers, {} stations".format(len(self.servers), len(self.stations)))
+        print("{:>10} {:>15} {:>7} {:>7} {:>5} {:>5} {:>5} {:>8} {:>8} {:>9}".format(
+            "server", "address", "station", "samples", "min", "max", "avg",
+            "packets", "invalid", "recovered"))
+        for (serverID, stationID) in sorted(self.stations):
+            station = self.stations[(serverID, stationID)]
+            lastSecond = station['lastSecond']
+            if lastSecond is None or now - station['lastSeen'] > 2 * REPORT_INTERVAL_SECONDS:
+                lastSecond = (0, '-', '-', '-')
+            print("{:>10x} {:>15} {:>7} {:>7} {:>5} {:>5} {:>5} {:>8} {:>8} {:>9}".format(
+                serverID, self.servers[serverID]['address'], stationID,
+                lastSecond[0], lastSecond[1], lastSecond[2], lastSecond[3],
+                station['packets'], station['invalidPackets'],
+                station['recoveredPackets']))
+        for serverID in sorted(self.servers):
+            server = self.servers[serverID]
+            print("server {:x}: frames: {}, missedFrames: {}".format(serverID,
+                server['frames'], server['missedFrames']))
+        print("")
+        if self.csvFile:
+            self.csvFile.flush()
+
+def main():
+    port = 8890
+    csvFile = None
+    if len(sys.argv) >= 2:
+        port = int(sys.argv[1])
+    if len(sys.argv) >= 3:
+        csvFile = open(sys.argv[2], 'a')
+        if csvFile.tell() == 0:
+            csvFile.write("time,server,station,count,min,max,avg\n")
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('', port))
+    sock.settimeout(0.5)
+    print("Listening for uplink frames on port {}".format(port))
+
+    collector = Collector(csvFile)
+    lastReport = time.time()
+    while True:
+        try:
+            data, sender = sock.recvfrom(8192)
+            frame = decodeFrame(data)
+            if frame is None:
+                print("Discarding unknown frame from {}, bytes: {}".format(
+                    sender[0], len(data)))
+            else:
+                collector.handleFrame(frame, sender, time.time())
+        except socket.timeout:
+            pass
+
+        now = time.time()
+        if now - lastReport >= REPORT_INTERVAL_SECONDS:
+            collector.report(now)
+            lastReport = now
+
+if __name__ == '__main__':
+    main()
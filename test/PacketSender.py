@@ -1,6 +1,35 @@
 import socket
 import struct
 
+def encodeSamples(stationID, packetNumber, samples):
+    # See the C++ code for encoding structures.  Samples are sent in groups
+    # of four so the list is padded with zeros to a multiple of four.
+    samples = list(samples)
+    while len(samples) % 4 != 0:
+        samples.append(0)
+
+    data = bytearray(struct.pack('BB', stationID, packetNumber % 256))
+    for i in range(0, len(samples), 4):
+        group = samples[i:i+4]
+        msbs = 0
+        for j in range(4):
+            data.append(group[j] & 0xFF)
+            msbs |= ((int(group[j] / 256)) & 0x3) << (6 - 2*j)
+        data.append(msbs)
+    return bytes(data)
+
+def encodeParity(stationID, firstPacketNumber, groupSize, packets):
+    # See ForwardErrorCorrection.h for the parity packet layout.  packets are
+    # the encoded data packets of the group and the header of each is skipped.
+    payloadLength = max(len(p) for p in packets) - 2
+    parity = bytearray(payloadLength)
+    for p in packets:
+        for i, b in enumerate(p[2:]):
+            parity[i] ^= b
+    header = struct.pack('BBBB', stationID, firstPacketNumber % 256, groupSize,
+            payloadLength)
+    return header + bytes(parity)
+
 def sendData(stationID, packetNumber, valueData1, valueData2, valueData3, valueData4):
     UDP_IP = "192.168.4.1"
     UDP_PORT = 8888
@@ -8,18 +37,8 @@ def sendData(stationID, packetNumber, valueData1, valueData2, valueData3, valueD
     # PacketNumber must be modulo 255
     packetNumber %= 255
 
-    # See the C++ code for encoding structures.
-    dataByte1 = valueData1 & 0xFF
-    dataByte2 = valueData2 & 0xFF
-    dataByte3 = valueData3 & 0xFF
-    dataByte4 = valueData4 & 0xFF
-    dataByte5  = ((int(valueData1 / 256 ) ) & 0x3 ) << 6
-    dataByte5 |= ((int(valueData2 / 256 ) ) & 0x3 ) << 4
-    dataByte5 |= ((int(valueData3 / 256 ) ) & 0x3 ) << 2
-    dataByte5 |= ((int(valueData4 / 256 ) ) & 0x3 )
-
-    data = struct.pack('BBBBBBB', stationID, packetNumber, dataByte1, dataByte2,
-            dataByte3, dataByte4, dataByte5 )
+    data = encodeSamples(stationID, packetNumber,
+            [valueData1, valueData2, valueData3, valueData4])
 
     print("UDP target IP: {}, port: {}, stationId: {}, PacketNumber: {}, Value1: {}".format(UDP_IP, UDP_PORT, stationID, packetNumber,
                 valueData1))
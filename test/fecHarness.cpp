@@ -0,0 +1,87 @@
+// fecHarness.cpp
+//
+// Runs the server's ForwardErrorCorrection.h on the local machine so that
+// fecLossBenchmark.py can drive the real decoder.  Packets for a single
+// station are read from stdin, one per line, as a type letter followed by
+// the packet bytes in hex:
+//
+//   D <hex>   a data packet as it arrives on the data port
+//   P <hex>   a parity packet as it arrives on the FEC port
+//
+// One line is written to stdout for every line read:
+//
+//   used      the data packet was recorded (as handleUDPPacket would)
+//   late      the data packet was already rebuilt from parity and dropped
+//   R <hex>   the parity packet rebuilt this data packet
+//   -         the parity packet rebuilt nothing
+//
+// Build with (the group size defaults to the server's):
+//   g++ -DFEC_GROUP_SIZE=4 -o fecHarness fecHarness.cpp
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Stand-ins for the bits of the Arduino environment the headers use.
+typedef uint8_t byte;
+#define abs(x) ((x)>0?(x):-(x))
+
+struct HarnessSerial {
+  int printf(const char *, ...) { return 0; }
+};
+HarnessSerial Serial;
+
+#include "../ServerFirmware/ForwardErrorCorrection.h"
+
+#define HARNESS_MAX_PACKET_SIZE 1024
+
+int readHex(const char *hex, byte *out, int maxLength) {
+  int length = 0;
+  unsigned int b;
+  while (length < maxLength && sscanf(hex, "%2x", &b) == 1) {
+    out[length++] = b;
+    hex += 2;
+  }
+  return length;
+}
+
+void writeHex(const byte *data, int length) {
+  for (int i=0; i<length; i++) {
+    printf("%02x", data[i]);
+  }
+}
+
+int main() {
+  static FECState fecState;
+  initializeFECState(fecState);
+
+  static char line[2 * HARNESS_MAX_PACKET_SIZE + 8];
+  byte packet[HARNESS_MAX_PACKET_SIZE];
+  byte recoveredPacket[HEADER_SIZE + FEC_MAX_PAYLOAD_SIZE];
+
+  while (fgets(line, sizeof(line), stdin)) {
+    if (strlen(line) < 2) {
+      continue;
+    }
+    int n = readHex(line + 2, packet, HARNESS_MAX_PACKET_SIZE);
+
+    if (line[0] == 'D') {
+      if (isFECPacketRecovered(fecState, getPacketNumber(packet))) {
+        printf("late\n");
+      } else {
+        recordFECDataPacket(fecState, packet, n);
+        printf("used\n");
+      }
+    } else if (line[0] == 'P') {
+      int recoveredLength = recoverFECPacket(fecState, packet, n, recoveredPacket);
+      if (recoveredLength > 0) {
+        printf("R ");
+        writeHex(recoveredPacket, recoveredLength);
+        printf("\n");
+      } else {
+        printf("-\n");
+      }
+    }
+  }
+  return 0;
+}
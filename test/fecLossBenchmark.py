@@ -0,0 +1,183 @@
+
+# Loss injection benchmark for the forward error correction (FEC) scheme that
+# is described in ServerFirmware/ForwardErrorCorrection.h.  This runs entirely
+# on the local machine; nothing is sent over the network.
+#
+# A stream of node packets (and, with FEC on, a parity packet after every
+# group) is pushed through a link that drops each datagram independently with
+# the given probability.  What gets through is fed to the server's own decoder
+# by way of fecHarness.cpp, which is built with g++ (or $CXX) for each group
+# size.
+# For each loss rate and group size the effective sample loss and the extra
+# bandwidth used are printed.  Every rebuilt packet is also checked byte for
+# byte against what was originally sent.
+#
+# Data and parity packets travel on different ports so the parity packet can
+# overtake the last data packet of its group.  The "parityFirst" rows deliver
+# every parity packet ahead of that data packet.  The late original must then
+# be dropped rather than used a second time; "doubled" counts the packets
+# whose samples were used twice and should always be 0.
+#
+# Usage:
+#   python fecLossBenchmark.py [numberOfPackets] [seed]
+#
+
+import binascii
+import os
+import random
+import subprocess
+import sys
+import tempfile
+
+import PacketSender
+
+# Matches PACKETSAMPLESIZE in the node firmware.
+SAMPLES_PER_PACKET = 16
+
+# IPv4 + UDP header bytes that go along with every datagram.
+UDP_OVERHEAD_BYTES = 28
+
+LOSS_RATES = [0.0, 0.01, 0.02, 0.05, 0.10, 0.20]
+GROUP_SIZES = [0, 2, 4, 8]
+
+def buildHarness(outputDirectory, groupSize):
+    # The decoder's group size is a compile time setting so there is one
+    # harness per group size.
+    testDirectory = os.path.dirname(os.path.abspath(__file__))
+    source = os.path.join(testDirectory, 'fecHarness.cpp')
+    harness = os.path.join(outputDirectory, 'fecHarness{}'.format(groupSize))
+    compiler = os.environ.get('CXX', 'g++')
+    subprocess.check_call([compiler, '-DFEC_GROUP_SIZE={}'.format(groupSize),
+        '-o', harness, source])
+    return harness
+
+def runHarness(harness, datagrams):
+    # datagrams is a list of (type, packet) tuples in arrival order and one
+    # reply comes back for each.
+    lines = ''.join('{} {}\n'.format(kind, binascii.hexlify(packet).decode())
+            for kind, packet in datagrams)
+    process = subprocess.Popen([harness], stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE, universal_newlines=True)
+    output, _ = process.communicate(lines)
+    return output.splitlines()
+
+def runLink(harnesses, seed, numberOfPackets, lossRate, groupSize, parityFirst):
+    # Sample values, data packet loss and parity packet loss each get their
+    # own generator.  That way every group size sees exactly the same data
+    # and the same data packet loss trace.
+    sampleRng = random.Random(seed)
+    dataLossRng = random.Random(seed + 1)
+    parityLossRng = random.Random(seed + 2)
+
+    stationID = 1
+    sent = []
+    bytesSent = 0
+
+    # Everything that makes it across the link, in arrival order, along with
+    # the full packet number of each data packet.
+    datagrams = []
+    packetNumbers = []
+    group = []
+
+    for packetNumber in range(numberOfPackets):
+        samples = [sampleRng.randint(0, 1023) for _ in range(SAMPLES_PER_PACKET)]
+        packet = PacketSender.encodeSamples(stationID, packetNumber, samples)
+        sent.append(packet)
+        bytesSent += len(packet) + UDP_OVERHEAD_BYTES
+
+        arrivals = []
+        if dataLossRng.random() >= lossRate:
+            arrivals.append(('D', packet, packetNumber))
+
+        if groupSize:
+            group.append(packet)
+            if packetNumber % groupSize == groupSize - 1:
+                firstPacketNumber = packetNumber - groupSize + 1
+                parity = PacketSender.encodeParity(stationID, firstPacketNumber,
+                        groupSize, group)
+                group = []
+                bytesSent += len(parity) + UDP_OVERHEAD_BYTES
+                if parityLossRng.random() >= lossRate:
+                    if parityFirst:
+                        arrivals.insert(0, ('P', parity, firstPacketNumber))
+                    else:
+                        arrivals.append(('P', parity, firstPacketNumber))
+
+        for kind, datagram, number in arrivals:
+            datagrams.append((kind, datagram))
+            packetNumbers.append(number)
+
+    if groupSize:
+        replies = runHarness(harnesses[groupSize], datagrams)
+    else:
+        # Without FEC every data packet that arrives is used.
+        replies = ['used'] * len(datagrams)
+
+    delivered = set()
+    mismatches = 0
+    doubled = 0
+    for (kind, datagram), number, reply in zip(datagrams, packetNumbers, replies):
+        if kind == 'D':
+            if reply == 'used':
+                if number in delivered:
+                    doubled += 1
+                delivered.add(number)
+        elif reply.startswith('R '):
+            recovered = bytearray(binascii.unhexlify(reply[2:]))
+            # Packet numbers wrap at 256 so find the full number from the
+            # group that the parity packet covers.
+            recoveredNumber = number + (recovered[1] - datagram[1]) % 256
+            if bytes(recovered) != sent[recoveredNumber]:
+                mismatches += 1
+            if recoveredNumber in delivered:
+                doubled += 1
+            delivered.add(recoveredNumber)
+
+    lostSamples = (numberOfPackets - len(delivered)) * SAMPLES_PER_PACKET
+    return lostSamples, bytesSent, mismatches, doubled
+
+def main():
+    numberOfPackets = 20000
+    seed = 1
+    if len(sys.argv) >= 2:
+        numberOfPackets = int(sys.argv[1])
+    if len(sys.argv) >= 3:
+        seed = int(sys.argv[2])
+
+    # Keep whole groups so each scheme sends the same data packets.
+    numberOfPackets -= numberOfPackets % max(GROUP_SIZES)
+    totalSamples = numberOfPackets * SAMPLES_PER_PACKET
+
+    outputDirectory = tempfile.mkdtemp()
+    harnesses = {}
+    for groupSize in GROUP_SIZES:
+        if groupSize:
+            harnesses[groupSize] = buildHarness(outputDirectory, groupSize)
+
+    print("packets: {}, samplesPerPacket: {}, seed: {}".format(
+        numberOfPackets, SAMPLES_PER_PACKET, seed))
+    print("{:>9} {:>12} {:>9} {:>12} {:>12} {:>11} {:>8}".format(
+        "linkLoss", "order", "fecGroup", "sampleLoss", "extraBytes",
+        "mismatches", "doubled"))
+
+    for lossRate in LOSS_RATES:
+        baselineBytes = None
+        for parityFirst in [False, True]:
+            for groupSize in GROUP_SIZES:
+                if parityFirst and not groupSize:
+                    # Nothing to reorder without parity packets.
+                    continue
+                lostSamples, bytesSent, mismatches, doubled = runLink(harnesses,
+                        seed, numberOfPackets, lossRate, groupSize, parityFirst)
+                if baselineBytes is None:
+                    baselineBytes = bytesSent
+                print("{:>8.1f}% {:>12} {:>9} {:>11.2f}% {:>11.1f}% {:>11} {:>8}".format(
+                    lossRate * 100,
+                    "parityFirst" if parityFirst else "inOrder",
+                    groupSize if groupSize else "off",
+                    100.0 * lostSamples / totalSamples,
+                    100.0 * (bytesSent - baselineBytes) / baselineBytes,
+                    mismatches, doubled))
+
+if __name__ == '__main__':
+    main()
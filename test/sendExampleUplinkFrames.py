@@ -0,0 +1,77 @@
+
+# Pretends to be a number of servers running with UPLINK_ENABLED and sends
+# uplink frames (see ServerFirmware/Uplink.h) to a collector.  By default the
+# frames go to a collector on this machine:
+#
+#   python ../UplinkCollector/uplinkCollector.py
+#   python sendExampleUplinkFrames.py 3 4
+#
+
+import random
+import socket
+import struct
+import sys
+import time
+
+BUCKETS_PER_FRAME = 10
+BUCKET_MILLIS = 100
+
+def encodeFrame(serverID, frameSequence, frameStartMillis, sendMillis, stations):
+    data = struct.pack('<BBBBIHHII', 0xA5, 1, len(stations), BUCKETS_PER_FRAME,
+            serverID, frameSequence % 65536, BUCKET_MILLIS, frameStartMillis,
+            sendMillis)
+    for (stationID, packets, invalidPackets, recoveredPackets, buckets) in stations:
+        data += struct.pack('<BBHHH', stationID, 0, packets, invalidPackets,
+                recoveredPackets)
+        for (count, minValue, maxValue, average) in buckets:
+            data += struct.pack('<BHHH', count, minValue, maxValue, average)
+    return data
+
+def makeBuckets(level):
+    buckets = []
+    for _ in range(BUCKETS_PER_FRAME):
+        samples = [max(0, min(1023, int(random.gauss(level, 60)))) for _ in range(10)]
+        buckets.append((len(samples), min(samples), max(samples),
+            sum(samples) // len(samples)))
+    return buckets
+
+def main():
+    numberOfServers = 2
+    stationsPerServer = 4
+    collectorIP = "127.0.0.1"
+    collectorPort = 8890
+
+    if len(sys.argv) >= 2:
+        numberOfServers = int(sys.argv[1])
+    if len(sys.argv) >= 3:
+        stationsPerServer = int(sys.argv[2])
+    if len(sys.argv) >= 4:
+        collectorIP = sys.argv[3]
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    serverIDs = [random.randint(0, 0xFFFFFFFF) for _ in range(numberOfServers)]
+    levels = {}
+    start = time.time()
+    frameSequence = 0
+
+    while True:
+        sendMillis = int((time.time() - start) * 1000) + BUCKETS_PER_FRAME * BUCKET_MILLIS
+        for serverID in serverIDs:
+            stations = []
+            for stationID in range(2, 2 + stationsPerServer):
+                level = levels.get((serverID, stationID), 400)
+                level = max(50, min(950, level + random.randint(-80, 80)))
+                levels[(serverID, stationID)] = level
+                stations.append((stationID, 6, random.randint(0, 1),
+                    random.randint(0, 1), makeBuckets(level)))
+            frame = encodeFrame(serverID, frameSequence,
+                    sendMillis - BUCKETS_PER_FRAME * BUCKET_MILLIS,
+                    sendMillis, stations)
+            sock.sendto(frame, (collectorIP, collectorPort))
+        print("Sent frame {} for {} servers, bytes per frame: {}".format(
+            frameSequence, numberOfServers, len(frame)))
+        frameSequence += 1
+        time.sleep(1)
+
+if __name__ == '__main__':
+    main()